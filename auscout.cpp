@@ -2,7 +2,9 @@
 #include <cstdio>
 #include <string>
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
+#include <vector>
 #include <iostream>
 #include <iomanip>
 #include <boost/filesystem.hpp>
@@ -25,8 +27,8 @@ namespace ag = boost::algorithm;
 
 struct Args {
 	string cmd, host, key;
-	fs::path dirname;
-	int port, t, sr, n_secs;
+	fs::path dirname, file;
+	int port, t, sr, n_secs, batch;
 	long long id_value;
 	float threshold;
 };
@@ -37,14 +39,18 @@ Args ParseOptions(int argc, char **argv){
 	try {
 		descr.add_options()
 			("help,h", "produce help message")
-			("key,k", po::value<string>(&args.key)->required(), "redis key string")
-			("dir,d", po::value<fs::path>(&args.dirname)->required(), "directory of audio files to process")
-			("cmd,c", po::value<string>(&args.cmd)->required(), "command: add, del, lookup or help")
+			("key,k", po::value<string>(&args.key), "redis key string")
+			("dir,d", po::value<fs::path>(&args.dirname), "directory of audio files to process")
+			("file,f", po::value<fs::path>(&args.file), "fingerprint file written by write, or for import its name in the server's IMPORTDIR")
+			("cmd,c", po::value<string>(&args.cmd)->required(),
+			 "command: add, del, lookup, write, import or help")
 			("server,s", po::value<string>(&args.host)->default_value("localhost"),
 			   "redis server hostname or unix domain socket path - e.g. localhost or 127.0.0.1")
 			("port,p", po::value<int>(&args.port)->default_value(6379), "redis server port")
 			("toggles,g", po::value<int>(&args.t)->default_value(4), "query parameter - 0 to 8")
 			("sr", po::value<int>(&args.sr)->default_value(6000), "sample rate - e.g. 6000")
+			("batch,b", po::value<int>(&args.batch)->default_value(1),
+			 "number of files to add per command - 1 to 10000")
 			("nsecs,n", po::value<int>(&args.n_secs)->default_value(0),
 			 "number seconds to process from  each file - deafult value 0 for whole file")
 			("threshold,t", po::value<float>(&args.threshold)->default_value(0.25),
@@ -63,6 +69,12 @@ Args ParseOptions(int argc, char **argv){
 		}
 
 		po::notify(vm);
+		if ((args.cmd != "write" && args.key.empty())
+			|| ((args.cmd == "add" || args.cmd == "lookup" || args.cmd == "write") && args.dirname.empty())
+			|| ((args.cmd == "write" || args.cmd == "import") && args.file.empty())){
+			cout << descr << endl;
+			exit(0);
+		}
 	} catch (const po::error &ex){
 		cout << descr << endl;
 		exit(0);
@@ -71,8 +83,46 @@ Args ParseOptions(int argc, char **argv){
 	return args;
 }
 
-int SubmitFiles(redisContext *c, const string &keystr, const fs::path &dirname, const int sr){
+/* a file's fingerprint, in network byte order, waiting to be added */
+struct PendingTrack {
+	vector<uint32_t> hashes;
+	string filename;
+};
+
+/* add the pending tracks with one auscout.madd command, and return */
+/* the number added, or -1 once disconnected                         */
+int SubmitBatch(redisContext *c, const string &keystr, vector<PendingTrack> &pending){
+	if (pending.empty()) return 0;
+	string n = to_string(pending.size());
+	vector<const char*> argv = { "auscout.madd", keystr.c_str(), n.c_str() };
+	vector<size_t> argvlen = { strlen("auscout.madd"), keystr.length(), n.length() };
+	for (PendingTrack &track : pending){
+		argv.push_back((const char*)track.hashes.data());
+		argvlen.push_back(track.hashes.size()*sizeof(uint32_t));
+		argv.push_back(track.filename.c_str());
+		argvlen.push_back(track.filename.length());
+	}
+
+	redisReply *reply = (redisReply*)redisCommandArgv(c, argv.size(), argv.data(), argvlen.data());
+	int count = 0;
+	if (reply && reply->type == REDIS_REPLY_ARRAY){
+		for (size_t i=0;i < reply->elements;i++)
+			cout << "=> " << pending[i].filename << " added with id = " << reply->element[i]->integer << endl;
+		count = reply->elements;
+	} else if (reply && reply->type == REDIS_REPLY_ERROR){
+		cerr << "=> error - " << reply->str << endl;
+	} else {
+		cerr << "Disconnected" << endl;
+		count = -1;
+	}
+	if (reply) freeReplyObject(reply);
+	pending.clear();
+	return count;
+}
+
+int SubmitFiles(redisContext *c, const string &keystr, const fs::path &dirname, const int sr, const int batch){
 	fs::directory_iterator dir(dirname), end;
+	vector<PendingTrack> pending;
 
 	int count = 0;
 	int err;
@@ -107,6 +157,18 @@ int SubmitFiles(redisContext *c, const string &keystr, const fs::path &dirname,
 				
 				string filename = dir->path().filename().string();
 
+				if (batch > 1){
+					pending.push_back({vector<uint32_t>(hasharray, hasharray + n_hashes), filename});
+					free_mdata(&mdata);
+					ph_free_hash(&hash);
+					if ((int)pending.size() == batch){
+						int n = SubmitBatch(c, keystr, pending);
+						if (n < 0) break;
+						count += n;
+					}
+					continue;
+				}
+
 				redisReply *reply = (redisReply*)redisCommand(c, "auscout.addtrack %s %b %s",
 												 keystr.c_str(), (void*)hasharray,
 												 n_hashes*sizeof(uint32_t), filename.c_str());
@@ -131,11 +193,102 @@ int SubmitFiles(redisContext *c, const string &keystr, const fs::path &dirname,
 		}
 	}
 
+	int n = SubmitBatch(c, keystr, pending);
+	if (n > 0) count += n;
+
 	delete sigbuf;
 	ph_free_hashst(&info);
 	return count;
 }
 
+/* fingerprint the files in dirname into a file for auscout.import, */
+/* and return the number written                                     */
+int WriteFiles(const fs::path &filename, const fs::path &dirname, const int sr){
+	FILE *fp = fopen(filename.string().c_str(), "wb");
+	if (fp == NULL){
+		cerr << "unable to open " << filename << endl;
+		return 0;
+	}
+
+	// magic, version and track count, which is filled in at the end
+	uint32_t header[4] = { 0, htonl(1), 0, 0 };
+	memcpy(header, "ASFP", 4);
+	fwrite(header, sizeof(header), 1, fp);
+
+	fs::directory_iterator dir(dirname), end;
+	uint64_t count = 0;
+	int err;
+	int len;
+	AudioMetaData mdata;
+	AudioHashStInfo info;
+	AudioHash hash;
+	ph_init_hashst(&info);
+
+	const int buflen = 1 << 25;
+	const char zeros[4] = { 0 };
+	float *sigbuf = new float[buflen];
+	for ( ; dir != end; ++dir){
+		if (fs::is_regular_file(dir->status())){
+			string path = dir->path().string();
+			len = buflen;
+			float *buf = readaudio(path.c_str(), sr, 0, sigbuf, &len, &mdata, &err);
+			if (buf == NULL){
+				cerr << "bad file" << endl;
+				continue;
+			}
+
+			ph_audiohash(buf, len, &hash, &info, 0, sr);
+
+			string filename = dir->path().filename().string();
+			cout << "(" << count << ") " << filename
+				 << " samples - " << len << " frames " << hash.nbhashes << endl;
+
+			uint32_t *hasharray = hash.hasharray;
+			int n_hashes = hash.nbhashes;
+			SERIALIZE_TO_NET(hasharray, n_hashes);
+
+			// id 0 for the server to assign, frames, descr length
+			uint32_t track[4] = { 0, 0, htonl(n_hashes), htonl(filename.length()) };
+			fwrite(track, sizeof(track), 1, fp);
+			fwrite(filename.data(), 1, filename.length(), fp);
+			fwrite(zeros, 1, (4 - filename.length() % 4) % 4, fp);
+			fwrite(hasharray, sizeof(uint32_t), n_hashes, fp);
+
+			free_mdata(&mdata);
+			ph_free_hash(&hash);
+			count++;
+		}
+	}
+
+	uint32_t n_tracks[2] = { htonl(count >> 32), htonl(count & 0xffffffff) };
+	fseek(fp, 8, SEEK_SET);
+	fwrite(n_tracks, sizeof(n_tracks), 1, fp);
+	if (fclose(fp) != 0)
+		cerr << "error writing " << filename << endl;
+
+	delete[] sigbuf;
+	ph_free_hashst(&info);
+	return count;
+}
+
+/* have the server load a fingerprint file, the file name is within */
+/* the import directory of the server                                */
+int ImportFile(redisContext *c, const string &keystr, const fs::path &filename){
+	string path = filename.string();
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.import %s %s", keystr.c_str(), path.c_str());
+	int count = 0;
+	if (reply && reply->type == REDIS_REPLY_INTEGER){
+		count = reply->integer;
+		cout << "=> imported " << count << " tracks" << endl;
+	} else if (reply && reply->type == REDIS_REPLY_ERROR){
+		cerr << "=> error - " << reply->str << endl;
+	} else {
+		cerr << "Disconnected" << endl;
+	}
+	if (reply) freeReplyObject(reply);
+	return count;
+}
+
 int DeleteId(redisContext *c, const string &keystr, long long id){
 	cout << "delete " << id << endl;
 	redisReply *reply = (redisReply*)redisCommand(c, "auscout.del %s %lld", keystr.c_str(), id);
@@ -252,6 +405,14 @@ int main(int argc, char **argv){
 
 	Args args = ParseOptions(argc, argv);
 
+	if (args.cmd == "write"){
+		cout << "Write files in " << args.dirname << " to " << args.file << endl;
+		int n = WriteFiles(args.file, args.dirname, args.sr);
+		cout << "Total " << n << " files processed." << endl;
+		cout << "Done." << endl;
+		return 0;
+	}
+
 	cout << endl << "Connect to " << args.host << ":" << args.port << endl;
 	
 	redisContext *c = redisConnect(args.host.c_str(), args.port);
@@ -266,11 +427,14 @@ int main(int argc, char **argv){
 	int n = 0;
 	if (args.cmd == "add"){
 		cout << "Add files in " << args.dirname << " to key, " << args.key << endl;
-		n = SubmitFiles(c, args.key, args.dirname, args.sr);
+		n = SubmitFiles(c, args.key, args.dirname, args.sr, min(max(args.batch, 1), 10000));
 	} else if (args.cmd == "lookup"){
 		cout << "Lookup files in " << args.dirname << " from key, " << args.key << endl;
 		cout << "(  threshold = " << args.threshold << ")" << endl;
 		n = QueryFiles(c, args.key, args.dirname, args.sr, args.t, args.n_secs, args.threshold);
+	} else if (args.cmd == "import"){
+		cout << "Import " << args.file << " to key, " << args.key << endl;
+		n = ImportFile(c, args.key, args.file);
 	} else if (args.cmd == "del"){
 		cout << "Delete id = " << args.id_value << endl;
 		DeleteId(c, args.key, args.id_value);
@@ -0,0 +1,117 @@
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include "hiredis.h"
+
+/* Times lookups against a local redis-server with the module loaded. */
+/* usage: benchclient [n_tracks] [n_frames] [n_queries] [query_frames] */
+/*                    [toggle_bits] [settle_ms]                        */
+/* The defaults index 10M frames in 1000 tracks, then look up 20       */
+/* queries of 300 random frames with 16 toggle bits each, so nearly    */
+/* every candidate probed is absent.  settle_ms is the wait after the  */
+/* adds for the delta to be merged into read segments.                 */
+
+using namespace std;
+
+struct BenchArgs {
+	int n_tracks = 1000;
+	int n_frames = 10000;
+	int n_queries = 20;
+	int query_frames = 300;
+	int toggle_bits = 16;
+	int settle_ms = 5000;
+};
+
+/* a toggle word of n_bits distinct random bits */
+static uint32_t random_toggle(int n_bits){
+	uint32_t toggle = 0;
+	while (__builtin_popcount(toggle) < n_bits)
+		toggle |= 1U << (rand() % 32);
+	return toggle;
+}
+
+static void AddTracks(redisContext *c, const string &key, const BenchArgs &args){
+	vector<uint32_t> frames(args.n_frames);
+	for (int i=0;i < args.n_tracks;i++){
+		for (int j=0;j < args.n_frames;j++)
+			frames[j] = htonl(rand());
+		redisReply *reply = (redisReply*)redisCommand(c, "auscout.add %s %b", key.c_str(),
+													  (void*)frames.data(), frames.size()*sizeof(uint32_t));
+		assert(reply != NULL);
+		assert(reply->type == REDIS_REPLY_INTEGER);
+		freeReplyObject(reply);
+	}
+}
+
+/* returns the seconds taken by all the lookups */
+static double RunQueries(redisContext *c, const string &key, const BenchArgs &args){
+	vector<uint32_t> frames(args.query_frames), toggles(args.query_frames);
+	double total = 0;
+	for (int i=0;i < args.n_queries;i++){
+		for (int j=0;j < args.query_frames;j++){
+			frames[j] = htonl(rand());
+			toggles[j] = htonl(random_toggle(args.toggle_bits));
+		}
+
+		auto start = chrono::steady_clock::now();
+		redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f", key.c_str(),
+													  (void*)frames.data(), frames.size()*sizeof(uint32_t),
+													  (void*)toggles.data(), toggles.size()*sizeof(uint32_t), 0.5);
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		assert(reply != NULL);
+		assert(reply->type == REDIS_REPLY_ARRAY);
+		freeReplyObject(reply);
+
+		total += elapsed.count();
+		cout << "  query " << i << ": " << fixed << setprecision(3) << elapsed.count() << "s" << endl;
+	}
+	return total;
+}
+
+int main(int argc, char **argv){
+	BenchArgs args;
+	int *fields[] = { &args.n_tracks, &args.n_frames, &args.n_queries,
+					  &args.query_frames, &args.toggle_bits, &args.settle_ms };
+	for (int i=1;i < argc && i <= 6;i++)
+		*fields[i-1] = atoi(argv[i]);
+	assert(args.toggle_bits >= 0 && args.toggle_bits <= 32);
+
+	redisContext *c = redisConnect("localhost", 6379);
+	assert(c != NULL);
+
+	string key = "mybench";
+	srand(1);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.delkey %s", key.c_str());
+	assert(reply != NULL);
+	freeReplyObject(reply);
+
+	cout << "Add " << args.n_tracks << " tracks of " << args.n_frames << " frames" << endl;
+	auto start = chrono::steady_clock::now();
+	AddTracks(c, key, args);
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cout << "  " << fixed << setprecision(3) << elapsed.count() << "s" << endl;
+
+	this_thread::sleep_for(chrono::milliseconds(args.settle_ms));
+
+	cout << "Look up " << args.n_queries << " queries of " << args.query_frames << " frames, "
+		 << args.toggle_bits << " toggle bits" << endl;
+	double total = RunQueries(c, key, args);
+	cout << "  total " << fixed << setprecision(3) << total << "s" << endl;
+
+	reply = (redisReply*)redisCommand(c, "auscout.delkey %s", key.c_str());
+	assert(reply != NULL);
+	freeReplyObject(reply);
+
+	redisFree(c);
+	return 0;
+}
@@ -1,667 +1,4690 @@
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <strings.h>
 #include <string>
 #include <vector>
-#include <map>
+#include <set>
+#include <unordered_map>
+#include <deque>
+#include <list>
+#include <algorithm>
+#include <cmath>
 #include <ctime>
 #include <chrono>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#define REDISMODULE_EXPERIMENTAL_API
 #include "redismodule.h"
 
 using namespace std;
 
-#define AUSCOUT_ENCODING_VERSION 0
+#define AUSCOUT_ENCODING_VERSION 2
 #define LOOKUP_ENTRIES_PER_FRAME_LIMIT 10
 #define LOOKUP_BLOCK  100
 #define LOOKUP_STEPS 16
+#ifndef PROBE_BATCH
+#define PROBE_BATCH 16                // candidates prefetched ahead of their probes
+#endif
+#define FRAME_TABLE_MIN_CAPACITY 64
+#define FRAME_TABLE_MIGRATE_STEPS 128 // old slots a grown table migrates per insert
+#define SEGMENT_DIR_MAX_BITS 16
+#ifndef SEGMENT_FILTER_BITS
+#define SEGMENT_FILTER_BITS 10        // filter bits per segment key, 0 for no filter
+#endif
+#define MERGE_TIMER_PERIOD 100        // ms between maintenance passes
+#define MERGE_DELTA_ENTRIES 65536     // delta postings that trigger a merge
+#define MERGE_DELTA_IDLE 1000         // ms without adds before a smaller delta is merged
+#define DELTA_RESERVE_MAX (4*MERGE_DELTA_ENTRIES) // keys a bulk add grows the delta for up front
+#define MERGE_SEGMENTS_MAX 16         // read segments that trigger a merge of the newest
+#define ASYNC_ADD_FRAMES_DEFAULT 20000 // tracks this long are indexed on a worker
+#define IMPORT_SEGMENT_POSTINGS (1 << 22) // postings per segment a worker builds
+#define LOOKUP_WORKERS_DEFAULT 4
+#define LOOKUP_WORKERS_MAX 64
+#define RECLAIM_RETIRED_MAX 4096      // retired allocations that trigger an early reclaim
+#define ARENA_MIN_BLOCK 16384
+#define ARENA_KEEP_MAX (1 << 20)      // larger arenas are released after a lookup
+#define TRACKER_MIN_CAPACITY 256
+#define VOTE_BATCH_KEYS (1 << 18)     // votes gathered before they are sorted into the bins
+#define PROBE_CACHE_MIN_CAPACITY 1024
+#define PROBE_CACHE_MAX_KEYS 65536    // probes shared by the queries of one mlookup
+#define MLOOKUP_MAX_QUERIES 10000
+#define MADD_MAX_TRACKS 10000
+#define IMPORT_REPLICATE_FRAMES (1 << 22) // frames per auscout.madd an import replicates as
+#define ASFP_MAGIC "ASFP"
+#define ASFP_VERSION 1
+#define RESULT_CACHE_MAX 1000000      // cached lookups per index
+#define STOP_POSTINGS_MAX 1000000000
+#define STREAM_TTL_DEFAULT 300        // s a stream session may sit idle
+#define STREAM_TTL_MAX 86400
+#define STREAM_FRAMES_REBASE (1 << 30) // stream frames renumbered past this
+#define LOOKUP_TOPK_MAX 1000
+#define LOOKUP_SCORER_WINDOW 0        // sliding window tracker
+#define LOOKUP_SCORER_OFFSET 1        // offset histogram votes
+#define LOOKUP_TOGGLE_BITS_MAX 20
+#define MIH_MAX_TABLES 4
+#define MIH_MAX_RADIUS 8
 
 static RedisModuleType *ASIndexType;
 
 const char *descr_field = "descr";
 
-typedef struct entry_t {
-	entry_t *prev, *next, *succ;
+/* postings for one hash frame value, allocated along with the list  */
+/* header.  Plain lists hold two parallel arrays: ords in             */
+/* data[0..capacity) and positions in data[capacity..2*capacity), in  */
+/* insertion order.  Compressed lists hold a head word and then       */
+/* capacity bytes of varints, filled from the back: the postings in   */
+/* bytes [start, capacity) are ordered by descending ord, each the    */
+/* difference from its ord to the next one's (0 for the last) then    */
+/* its position.  The head word packs the first ord with start, so an */
+/* add in ord order writes one entry into the room in front and       */
+/* republishes the head.                                              */
+/* A list worker lookups may be reading is only ever added to, by     */
+/* writing outside the published part, then publishing the length    */
+/* and head; any other change builds a new list and retires the old.  */
+typedef struct posting_list_t {
+	uint32_t length, capacity;
+	uint32_t data[];
+} PostingList;
+
+#define POSTING_ORDS(pl) ((pl)->data)
+#define POSTING_POS(pl) ((pl)->data + (pl)->capacity)
+#define POSTING_HEAD(pl) ((uint64_t*)(pl)->data)
+#define POSTING_BYTES(pl) ((uint8_t*)((pl)->data + 2))
+#define HEAD_WORD(ord, start) (((uint64_t)(ord) << 32) | (start))
+
+/* walks a posting list newest first, whatever its encoding.  remaining */
+/* counts the postings left of a plain cursor, or of a compressed       */
+/* one in a segment, which ends at end                                  */
+typedef struct posting_cursor_t {
+	const uint32_t *ords, *positions;
+	const uint8_t *bytes, *end;
+	uint32_t remaining, ord;
+	bool compressed;
+} PostingCursor;
+
+/* a key's postings are published after the key is written, and a   */
+/* NULL postings pointer marks an empty slot.  Keys are never moved   */
+/* or removed - a key whose postings are all deleted points at        */
+/* empty_postings - so probe sequences stay intact for readers.       */
+typedef struct frame_slot_t {
+	uint32_t key;
+	PostingList *postings;
+} FrameSlot;
+
+/* open addressing (linear probing) table keyed on the hash frame    */
+/* value.  Only the main thread writes to it.  A full table is        */
+/* replaced by one twice the size that migrates its keys a few slots  */
+/* per insert, sharing their posting lists; until it is done, keys    */
+/* are looked up in the new table and then in old.  Emptied keys are  */
+/* left behind.                                                       */
+typedef struct frame_table_t {
+	uint64_t mask, size;        // size counts used slots, emptied keys too
+	struct frame_table_t *old;  // table being migrated, or NULL
+	uint64_t migrated;          // old slots migrated so far
+	uint64_t pending;           // used old slots not migrated yet
+	FrameSlot slots[];
+} FrameTable;
+
+/* Ordinals are never reused: a deleted track keeps its ordinal     */
+/* flagged TRACK_DELETED, since read segments may still hold its     */
+/* postings until the next merge drops them.  Only the ordinals of   */
+/* an add given up before any view or segment saw them are taken     */
+/* back, see release_add_job.  frames holds the hash values of the   */
+/* track run length coded, each with the position its run starts at. */
+/* Verifying lookups read it, so a deleted track's frames are        */
+/* retired.                                                          */
+typedef struct track_t {
 	int64_t id;
-	uint32_t pos, hash_value;
-} Entry;
-
-typedef struct entry_list_t {
-	entry_t *head;
-	uint32_t length;
-} EntryList;
-
+	uint32_t *frames;
+	uint32_t n_entries;
+	uint32_t flags;
+} Track;
+
+#define TRACK_HASHES(t) ((t)->frames)
+#define TRACK_POS(t) ((t)->frames + (t)->n_entries)
+
+#define TRACK_DELETED 0x01
+
+/* immutable read segment built by a merge.  keys are sorted and     */
+/* unique, and the postings of keys[i] lie in [offsets[i],           */
+/* offsets[i+1]): indices into ords/positions, ascending by ord, for */
+/* plain segments, or a byte range of bytes for compressed ones that */
+/* holds a count varint, the first ord, then the entries as coded in */
+/* a compressed posting list.                                        */
+/* dir[b] is the first key whose top dir_bits bits are >= b, so a    */
+/* search only bisects one bucket.  filter is a blocked Bloom filter  */
+/* of the keys, which turns most searches for absent keys away.       */
+/* stops are the sorted stop frames whose postings the merge dropped, */
+/* which are in the filter too.                                       */
+typedef struct segment_t {
+	uint32_t *keys;
+	uint64_t *offsets;
+	uint32_t *dir;
+	uint32_t *ords, *positions;
+	uint8_t *bytes;
+	uint32_t *filter;           // n_blocks blocks of 8 words, in filter_mem
+	void *filter_mem;
+	uint32_t *stops;
+	uint64_t n_keys, n_postings, n_bytes, n_blocks, n_stops;
+	uint32_t dir_bits;
+} Segment;
+
+/* the parts of an index a worker lookup reads.  The main thread     */
+/* publishes a new view whenever one of them is replaced, and        */
+/* retires the old view.  The delta table is shared, not copied.     */
+typedef struct index_view_t {
+	uint32_t flags;
+	FrameTable *delta, *frozen;
+	FrameTable *mih[MIH_MAX_TABLES];
+	Track *tracks;
+	uint32_t n_tracks;
+	uint32_t n_segments;
+	Segment *segments[];
+} IndexView;
+
+/* a merge running on a background thread.  The thread only reads    */
+/* the frozen delta and input segments and writes output; the        */
+/* maintenance timer installs the output on the main thread once     */
+/* done is set.  index is NULL if the key was freed mid merge, in    */
+/* which case the job owns its inputs.                               */
+typedef struct merge_job_t {
+	struct as_index_t *index;
+	FrameTable *frozen;
+	Segment **inputs;
+	uint32_t n_inputs, first;
+	uint8_t *dead;              // bitmap of deleted ordinals at start
+	uint32_t n_ords;
+	bool compressed;
+	bool full;                  // merges every segment
+	uint64_t dead_entries;      // of the index at start
+	Segment *output;
+	uint64_t purged;            // postings of deleted tracks dropped
+	int done;
+	pthread_t thread;
+} MergeJob;
+
+/* memory waiting to be freed, see retire() */
+typedef struct retired_t {
+	uint64_t epoch;
+	void *ptr;
+	void (*free)(void*);
+} Retired;
+
+#define AS_INDEX_COMPRESSED 0x01
+#define AS_INDEX_MIH_SHIFT 4         // bits 4-7 hold the number of substring tables
+#define AS_INDEX_MIH_TABLES(flags) (((flags) >> AS_INDEX_MIH_SHIFT) & 0x0f)
+
+/* adds and deletes go to the delta table, which the maintenance     */
+/* timer periodically merges into read segments.                     */
 typedef struct as_index_t {
-	RedisModuleDict *hash_dict; // frame / entry's
-	RedisModuleDict *id_dict;   // id / entry's
+	uint32_t flags;
+	FrameTable *delta;          // frame / postings, the mutable delta
+	FrameTable *frozen;         // delta being merged, read only
+	FrameTable *mih[MIH_MAX_TABLES]; // substring / hash values, see mih_add_value
+	FrameTable *mih_values;     // hash values in the substring tables, main thread only
+	Segment **segments;         // read segments, oldest first
+	uint32_t n_segments;
+	MergeJob *merge;            // merge in progress, if any
+	IndexView *view;            // published for worker lookups
+	Retired *unlinked;          // still reachable from view, retired on publish
+	uint32_t n_unlinked, unlinked_capacity;
+	RedisModuleDict *id_dict;   // id / track ordinal
+	Track *tracks;              // ordinal / track
+	uint32_t n_tracks, tracks_capacity;
 	uint64_t n_entries;
+	uint64_t delta_entries;     // postings in delta
+	uint64_t dead_entries;      // postings of deleted tracks left in segments
+	uint64_t postings_bytes, frozen_bytes, mih_bytes;
+	long long last_add;         // ms
+	int pins;                   // lookups in flight on worker threads
+	bool visible;               // handed to a worker lookup at least once
+	bool dropped;               // key freed while pinned, the last unpin frees
+	struct stream_session_t *sessions;  // open stream sessions
+	struct result_cache_t *cache;       // recent lookup results, if enabled
+	uint64_t generation;        // bumped by every add and delete
+	int64_t next_id;            // next id handed out, ids are dense from 1
+	uint64_t stop_probes;       // probes of stop frames skipped, added to by workers
 } ASIndex;
 
 typedef struct tracker_t {
 	int start_index, last_index, pos, count;
+	int heap_slot;              // 1 + slot in the top k heap, 0 if not in it
+	bool verified;              // the window passed verify_match, top k only
 } TrackerId;
 
+/* open addressing (linear probing) table of the tracks a lookup is  */
+/* following, keyed on ord + 1 so a zeroed slot is empty             */
+typedef struct tracker_slot_t {
+	uint32_t key;
+	TrackerId t;
+} TrackerSlot;
+
+typedef struct tracker_table_t {
+	TrackerSlot *slots;
+	uint32_t mask, size;
+} TrackerTable;
+
+/* bump allocator for the transient state of one lookup at a time.   */
+/* Memory is only given back by arena_reset, between lookups.        */
+typedef struct arena_block_t {
+	struct arena_block_t *next;
+	size_t size, used;
+	alignas(8) uint8_t data[];
+} ArenaBlock;
+
+typedef struct arena_t {
+	ArenaBlock *head;
+	size_t total;               // bytes in all blocks
+} Arena;
+
+/* the live postings of a hash frame value already probed by a batch */
+/* of queries: n (ord, pos) pairs in the arena                        */
+typedef struct probe_slot_t {
+	uint32_t key;
+	int32_t n;                  // -1 while the slot is empty
+	uint32_t *postings;
+} ProbeSlot;
+
+typedef struct probe_cache_t {
+	ProbeSlot *slots;
+	uint32_t mask, size;
+} ProbeCache;
+
+/* offset vote bins of a lookup, see run_offset_lookup */
+typedef struct vote_bins_t {
+	vector<uint64_t> keys;      // sorted
+	vector<uint32_t> counts;    // votes of each key
+	vector<uint64_t> batch;     // votes not counted yet, a key each
+	vector<uint64_t> scratch;   // of radix_sort and fold_votes
+	vector<uint32_t> scratch_counts;
+} VoteBins;
+
+/* best score of a track in a top k lookup */
+typedef struct topk_entry_t {
+	double cs;
+	int64_t id;
+	int pos;
+	uint32_t ord;
+} TopKEntry;
+
+/* kept by each lookup thread and reused from one lookup to the next */
+typedef struct lookup_state_t {
+	Arena arena;
+	TrackerTable tracker;
+	ProbeCache cache;           // slots is NULL unless probes are shared
+	TopKEntry *heap;            // min heap on cs of the best k tracks
+	uint32_t heap_size, topk;   // topk is 0 to stop at the first match
+	int radius;                 // hamming radius probed, -1 to probe toggles
+	uint64_t probes_left;       // probes the query may still make, UINT64_MAX for no limit
+	chrono::time_point<chrono::high_resolution_clock> deadline;  // probes stop expanding past it
+	bool truncated;             // the budget held back some probes of the query
+	double max_ber;             // bit error rate a match is verified to, 0 to not verify
+	const uint32_t *query;      // frames of the query run, for verify_match
+	uint32_t *aligned;          // arena scratch of verify_match
+	size_t aligned_capacity;
+	uint32_t *candidates;       // arena scratch of frame_candidates
+	uint32_t candidates_capacity;
+	uint64_t stop_probes;       // probes of stop frames skipped, see flush_stop_probes
+} LookupState;
+
+/* a streaming lookup: the tracker of a monitored stream, kept      */
+/* between pushes of its frames.  Sessions are listed in the index   */
+/* they were opened on and only live in memory.                      */
+typedef struct stream_session_t {
+	struct stream_session_t *next;
+	long long id;
+	LookupState state;          // tracker of the stream and its arena
+	double threshold;
+	int64_t frames_seen;        // stream frame of the next push's first
+	long long ttl, last_used;   // ms
+	bool busy;                  // a push is running
+	bool closed;                // closed while busy, freed once the push ends
+} StreamSession;
+
 typedef struct found_t {
 	int64_t id;
 	int64_t pos;
 	double cs;
 } FoundId;
 
-/*------------------- Aux. functions --------------------------------*/
+/*------------------- Frame hash table ------------------------------*/
 
-ASIndex* GetIndex(RedisModuleCtx *ctx, RedisModuleString *keystr){
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_READ);
-	int keytype = RedisModule_KeyType(key);
-	if (keytype == REDISMODULE_KEYTYPE_EMPTY){
-		RedisModule_CloseKey(key);
-		return NULL;
-	}
-	if (RedisModule_ModuleTypeGetType(key) != ASIndexType){
-		RedisModule_CloseKey(key);
-		throw -1;
+static inline uint64_t frame_hash(uint32_t key){
+	uint64_t h = key;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+/* shared by every key whose postings have all been deleted */
+static PostingList empty_postings = { 0, 0 };
+
+/* capacity is a power of two */
+FrameTable* frame_table_new(uint64_t capacity){
+	FrameTable *table = (FrameTable*)RedisModule_Calloc(1, sizeof(FrameTable) + capacity*sizeof(FrameSlot));
+	table->mask = capacity - 1;
+	table->size = 0;
+	table->old = NULL;
+	return table;
+}
+
+uint64_t frame_table_capacity(const FrameTable *table){
+	return table->mask + 1;
+}
+
+size_t frame_table_mem(const FrameTable *table){
+	size_t mem = sizeof(FrameTable) + frame_table_capacity(table)*sizeof(FrameSlot);
+	if (table->old != NULL) mem += frame_table_mem(table->old);
+	return mem;
+}
+
+static inline PostingList* frame_table_probe(const FrameTable *table, uint32_t key){
+	uint64_t i = frame_hash(key) & table->mask;
+	while (true){
+		PostingList *pl = __atomic_load_n(&table->slots[i].postings, __ATOMIC_ACQUIRE);
+		if (pl == NULL) return NULL;
+		if (table->slots[i].key == key) return pl;
+		i = (i + 1) & table->mask;
 	}
+}
 
-	ASIndex *index = (ASIndex*)RedisModule_ModuleTypeGetValue(key);
-	RedisModule_CloseKey(key);
-	return index;
+/* safe to call from any thread while the main thread inserts.  old */
+/* is read first: once it is NULL every key is in table              */
+PostingList* frame_table_get(const FrameTable *table, uint32_t key){
+	const FrameTable *old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+	PostingList *pl = frame_table_probe(table, key);
+	if (pl == NULL && old != NULL) pl = frame_table_probe(old, key);
+	return pl;
 }
 
-ASIndex* CreateIndex(RedisModuleCtx *ctx, RedisModuleString *keystr){
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_WRITE);
-	int keytype = RedisModule_KeyType(key);
-	if (keytype != REDISMODULE_KEYTYPE_EMPTY && RedisModule_ModuleTypeGetType(key) != ASIndexType){
-		RedisModule_CloseKey(key);
-		throw -1;
+static FrameSlot* frame_table_slot(const FrameTable *table, uint32_t key){
+	uint64_t i = frame_hash(key) & table->mask;
+	while (table->slots[i].postings != NULL){
+		if (table->slots[i].key == key) return (FrameSlot*)&table->slots[i];
+		i = (i + 1) & table->mask;
 	}
+	return NULL;
+}
 
-	ASIndex *index = NULL;
-	if (keytype == REDISMODULE_KEYTYPE_EMPTY){
-		index = (ASIndex*)RedisModule_Calloc(1, sizeof(ASIndex));
-		index->hash_dict = RedisModule_CreateDict(NULL);
-		index->id_dict = RedisModule_CreateDict(NULL);
-		index->n_entries = 0;
-		RedisModule_ModuleTypeSetValue(key, ASIndexType, index);
-	} else {
-		index = (ASIndex*)RedisModule_ModuleTypeGetValue(key);
+/* the slot for key, claiming an empty slot for a new key */
+static FrameSlot* frame_table_claim(FrameTable *table, uint32_t key){
+	uint64_t i = frame_hash(key) & table->mask;
+	while (true){
+		FrameSlot *slot = &table->slots[i];
+		if (slot->postings == NULL){
+			slot->key = key;
+			table->size++;
+			return slot;
+		}
+		if (slot->key == key) return slot;
+		i = (i + 1) & table->mask;
 	}
-	RedisModule_CloseKey(key);
-	return index;
 }
 
+/* the slot holding key, or NULL - main thread only.  A key still in */
+/* the old table is migrated first, unless it is emptied.            */
+FrameSlot* frame_table_find(FrameTable *table, uint32_t key){
+	FrameSlot *slot = frame_table_slot(table, key);
+	if (slot != NULL || table->old == NULL) return slot;
+	FrameSlot *from = frame_table_slot(table->old, key);
+	if (from == NULL || from->postings == &empty_postings) return from;
+	slot = frame_table_claim(table, key);
+	__atomic_store_n(&slot->postings, from->postings, __ATOMIC_RELEASE);
+	return slot;
+}
 
-void add_entry(RedisModuleDict *hash_dict, uint32_t hashframe, Entry *e){
-	EntryList *list = (EntryList*)RedisModule_DictGetC(hash_dict, &hashframe, sizeof(hashframe), NULL);
-	if (list == NULL) {    // new entry
-		list = (EntryList*)RedisModule_Calloc(1, sizeof(EntryList));
-		list->head = e;
-		list->length = 1;
-		RedisModule_DictReplaceC(hash_dict, &hashframe, sizeof(hashframe), list);
-		return;
+/* true when one more key would load the table past 7/8, counting */
+/* the keys still to migrate                                       */
+bool frame_table_full(const FrameTable *table){
+	return 8*(table->size + table->pending + 1) > 7*frame_table_capacity(table);
+}
+
+/* the slot for key, claiming an empty slot for a new key.  The     */
+/* caller must publish postings in a claimed slot before anything   */
+/* else is inserted or migrated, and grow a full table beforehand.  */
+FrameSlot* frame_table_insert(FrameTable *table, uint32_t key){
+	FrameSlot *slot = frame_table_claim(table, key);
+	if (slot->postings == NULL && table->old != NULL){
+		FrameSlot *from = frame_table_slot(table->old, key);
+		if (from != NULL && from->postings != &empty_postings)
+			__atomic_store_n(&slot->postings, from->postings, __ATOMIC_RELEASE);
 	}
-	e->next = list->head; // append entry to front of list
-	list->head->prev = e;
-	list->head = e;
-	list->length++;
+	return slot;
 }
 
-void remove_entry(RedisModuleDict *hash_dict, uint32_t hashframe, Entry *e){
-	if (e->prev == NULL && e->next == NULL){ // sole entry, remove 
-		EntryList *list = NULL;
-		RedisModule_DictDelC(hash_dict, &hashframe, sizeof(hashframe), &list);
-		RedisModule_Free(list);
-		return;
+/* migrate up to steps slots of the old table.  Returns the old   */
+/* table once all of it is migrated, which readers may still be    */
+/* probing, else NULL.                                             */
+FrameTable* frame_table_migrate(FrameTable *table, uint64_t steps){
+	FrameTable *old = table->old;
+	if (old == NULL) return NULL;
+	uint64_t end = frame_table_capacity(old);
+	if (steps < end - table->migrated) end = table->migrated + steps;
+	for (;table->migrated < end;table->migrated++){
+		const FrameSlot *from = &old->slots[table->migrated];
+		if (from->postings == NULL) continue;
+		table->pending--;
+		if (from->postings == &empty_postings) continue;
+		FrameSlot *slot = frame_table_claim(table, from->key);
+		if (slot->postings == NULL)
+			__atomic_store_n(&slot->postings, from->postings, __ATOMIC_RELEASE);
 	}
+	if (table->migrated < frame_table_capacity(old)) return NULL;
+	__atomic_store_n(&table->old, (FrameTable*)NULL, __ATOMIC_RELEASE);
+	return old;
+}
 
-	int no_key;
-	EntryList *list = (EntryList*)RedisModule_DictGetC(hash_dict, &hashframe, sizeof(hashframe), &no_key);
-	if (list == NULL || no_key) return;
+/* a table to replace table, at most half loaded once its keys and  */
+/* extra more are in, that migrates them from table.  table must    */
+/* not be migrating itself.                                          */
+FrameTable* frame_table_grow(FrameTable *table, uint64_t extra){
+	uint64_t capacity = FRAME_TABLE_MIN_CAPACITY;
+	while (capacity < 2*(table->size + extra + 1)) capacity *= 2;
+
+	FrameTable *grown = frame_table_new(capacity);
+	grown->old = table;
+	grown->migrated = 0;
+	grown->pending = table->size;
+	return grown;
+}
 
-	if (e->prev == NULL){           // entry at start of list
-		e->next->prev = NULL;
-		list->head = e->next;
-	} else if (e->next == NULL){   // entry at end of list
-		e->prev->next = NULL;
-	} else {                       // entry in middle of list
-		e->next->prev = e->prev;
-		e->prev->next = e->next;
+/* next slot holding postings at or after cursor, NULL when done.  */
+/* Slots of the old table follow, those of keys not migrated yet.  */
+FrameSlot* frame_table_next(const FrameTable *table, uint64_t *cursor){
+	uint64_t capacity = frame_table_capacity(table);
+	while (*cursor < capacity){
+		const FrameSlot *slot = &table->slots[(*cursor)++];
+		if (slot->postings != NULL && slot->postings != &empty_postings)
+			return (FrameSlot*)slot;
+	}
+	const FrameTable *old = table->old;
+	if (old == NULL) return NULL;
+	if (*cursor < capacity + table->migrated) *cursor = capacity + table->migrated;
+	while (*cursor < capacity + frame_table_capacity(old)){
+		const FrameSlot *slot = &old->slots[(*cursor)++ - capacity];
+		if (slot->postings != NULL && slot->postings != &empty_postings
+			&& frame_table_slot(table, slot->key) == NULL)
+			return (FrameSlot*)slot;
 	}
-	list->length--;
+	return NULL;
 }
 
-int64_t get_next_id(RedisModuleCtx *ctx, RedisModuleString *keystr){
-	int64_t id = RedisModule_Milliseconds() << 32;
+void frame_table_free(FrameTable *table){
+	if (table->old != NULL) RedisModule_Free(table->old);
+	RedisModule_Free(table);
+}
 
-	id |= (int64_t)(rand() & 0xffff0000);
+/*------------------- Epoch reclamation -----------------------------*/
 
-	string key = RedisModule_StringPtrLen(keystr, NULL);
-	key += ":counter";
+/* Memory a worker lookup may still be reading is retired rather    */
+/* than freed.  Workers publish the global epoch they entered in     */
+/* their reader slot, and retired memory is freed by the main thread */
+/* once every busy worker has entered a later epoch than the one it  */
+/* was retired in.                                                   */
+static uint64_t global_epoch = 1;
+static uint64_t reader_epochs[LOOKUP_WORKERS_MAX];  // 0 while idle
+static vector<Retired> retired;
 
-	RedisModuleCallReply *reply = RedisModule_Call(ctx, "INCRBY", "cl", key.c_str(), 1);
-	if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_INTEGER){
-		RedisModule_ReplyWithError(ctx, "ERR - Unable to generate unique Id");
-		return REDISMODULE_ERR;
-	}
+static inline void epoch_enter(int slot){
+	__atomic_store_n(&reader_epochs[slot], __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
 
-	id |= (0x0000ffffULL & RedisModule_CallReplyInteger(reply));
-	RedisModule_FreeCallReply(reply);
-	return id;
+static inline void epoch_exit(int slot){
+	__atomic_store_n(&reader_epochs[slot], 0, __ATOMIC_RELEASE);
 }
 
-/* return number of set bits in parameter value */
-int bitcount(uint32_t toggle){
-	uint32_t mask = 0x0001;
-	int count = 0;
-	while (toggle != 0){
-		if (toggle & mask) count++;
-		toggle >>= 1;
+/* free ptr once no worker can still see it - it must already be */
+/* unreachable for lookups that start from now on                */
+void retire(void *ptr, void (*free_fn)(void*)){
+	retired.push_back({__atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), ptr, free_fn});
+}
+
+void reclaim_retired(){
+	__atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+	uint64_t min_epoch = UINT64_MAX;
+	for (int i=0;i < LOOKUP_WORKERS_MAX;i++){
+		uint64_t epoch = __atomic_load_n(&reader_epochs[i], __ATOMIC_SEQ_CST);
+		if (epoch != 0 && epoch < min_epoch) min_epoch = epoch;
 	}
-	return count;
+
+	size_t n_kept = 0;
+	for (size_t i=0;i < retired.size();i++){
+		if (retired[i].epoch < min_epoch)
+			retired[i].free(retired[i].ptr);
+		else
+			retired[n_kept++] = retired[i];
+	}
+	retired.resize(n_kept);
 }
 
-/* permute the bits in hashvalue as marked by the set bits in toggle */
-/* put all permutations in vector                                    */
-void get_candidates(uint32_t hashvalue, uint32_t toggle, vector<uint32_t> &candidates){
-	int n_candidates = 0x01 << bitcount(toggle);
-	candidates.push_back(hashvalue);
-	for (int i=1;i < n_candidates;i++){
-		uint32_t curr_value = hashvalue;
-		uint32_t perms = i;
-		uint32_t bitnum = 0x80000000;
-		while (perms != 0 && bitnum != 0 && toggle != 0){
-			while ((bitnum & toggle) == 0 && bitnum != 0) bitnum >>= 1;
-			if ((perms & 0x00000001) != 0){
-				curr_value ^= bitnum;
-			}
-			perms >>= 1;
-			bitnum >>= 1;
-		}
-		candidates.push_back(curr_value);
+/* retire memory of an index, or free it right away if no worker */
+/* lookup was ever handed the index                               */
+void retire_index_mem(ASIndex *index, void *ptr, void (*free_fn)(void*)){
+	if (index->visible)
+		retire(ptr, free_fn);
+	else
+		free_fn(ptr);
+}
+
+/* retire memory the published view still reaches, once the next */
+/* publish_view makes it unreachable                              */
+void retire_after_publish(ASIndex *index, void *ptr, void (*free_fn)(void*)){
+	if (!index->visible){
+		free_fn(ptr);
+		return;
 	}
+	if (index->n_unlinked == index->unlinked_capacity){
+		index->unlinked_capacity = (index->unlinked_capacity) ? 2*index->unlinked_capacity : 8;
+		index->unlinked = (Retired*)RedisModule_Realloc(index->unlinked, index->unlinked_capacity*sizeof(Retired));
+	}
+	index->unlinked[index->n_unlinked++] = {0, ptr, free_fn};
 }
 
-bool lookup_hashframe(RedisModuleCtx *ctx, const int current,
-					  const double threshold,  RedisModuleDict *hash_dict,
-					  uint32_t hashframe, map<int64_t, TrackerId>  &tracker, vector<FoundId> &results){
-
-	bool found_match = false;
-	EntryList *list = (EntryList*)RedisModule_DictGetC(hash_dict, &hashframe, sizeof(hashframe), NULL);
-	if (list != NULL){
-		Entry *e = list->head;
-		int entry_count = 0;
-		while (e != NULL && entry_count < LOOKUP_ENTRIES_PER_FRAME_LIMIT){
-			if (tracker.count(e->id) > 0){
-				// already being tracked 
-				if (current <= tracker[e->id].last_index + LOOKUP_STEPS){
-					// tracked id still in range 
-					if (e->pos < tracker[e->id].pos) tracker[e->id].pos = e->pos;
-					tracker[e->id].count++;
-					tracker[e->id].last_index = current;
-				} 
-
-				// check if count is above threshold, and if so, add to results  
-				int window_length = tracker[e->id].last_index - tracker[e->id].start_index + 1;
-				if (window_length >= LOOKUP_BLOCK){
-					double cs = (double)tracker[e->id].count/(double)window_length;
-					if (cs >= threshold){
-						results.push_back({.id = e->id, .pos = tracker[e->id].pos, .cs = cs});
-						found_match = true;
-						tracker.erase(e->id);
-						return found_match;
-					}
-				}
+static void free_mem(void *ptr){
+	RedisModule_Free(ptr);
+}
 
-				if (current > tracker[e->id].last_index + LOOKUP_STEPS){
-					// tracked id falls out of range, reset starting index 
-					tracker[e->id].start_index = current;
-					tracker[e->id].last_index = current;
-					tracker[e->id].pos = e->pos;
-					tracker[e->id].count = 1;
-				}
+/*------------------- Aux. functions --------------------------------*/
 
-			} else {
-				// id not being tracked, start tracking
-				tracker[e->id] = {.start_index = current,
-								  .last_index = current,
-								  .pos = (int)e->pos,
-								  .count = 1 };
-			}
-			
-			e = e->next;
-			entry_count++;
-		}
-		
-	}
+/*------------------- Posting lists ---------------------------------*/
 
-	return found_match;
+static inline uint8_t* varint_encode(uint8_t *p, uint32_t value){
+	while (value >= 0x80){
+		*p++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t)value;
+	return p;
 }
 
-/* retrieve a descr field stored in keystr+id hash redis datatype */
-RedisModuleString* GetDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
-	string idstr = RedisModule_StringPtrLen(keystr, NULL);
-	idstr += ":" + to_string(id);
+static inline const uint8_t* varint_decode(const uint8_t *p, uint32_t *value){
+	uint32_t v = *p & 0x7f;
+	int shift = 7;
+	while (*p++ & 0x80){
+		v |= (uint32_t)(*p & 0x7f) << shift;
+		shift += 7;
+	}
+	*value = v;
+	return p;
+}
 
-	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_READ);
-	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
-		RedisModule_CloseKey(key);
-		return NULL;
+static inline uint32_t varint_size(uint32_t value){
+	uint32_t n = 1;
+	while (value >= 0x80){
+		value >>= 7;
+		n++;
 	}
+	return n;
+}
 
-	RedisModuleString *descr = NULL;
-	RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS, descr_field, &descr, NULL);
-	RedisModule_CloseKey(key);
-	return descr;
+/* cursor over length plain postings, stored in ascending order */
+static inline void posting_cursor_arrays(PostingCursor *c, const uint32_t *ords, const uint32_t *positions, uint32_t length){
+	c->remaining = length;
+	c->compressed = false;
+	c->ords = ords;
+	c->positions = positions;
 }
 
-/* set a descr field for a keystr+id redis hash data type */ 
-void SetDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id, RedisModuleString *descr){
-	string idstr = RedisModule_StringPtrLen(keystr, NULL);
-	idstr += ":" + to_string(id);
+/* cursor over the compressed postings in [bytes, end), the first */
+/* of them for ord                                                  */
+static inline void posting_cursor_bytes(PostingCursor *c, const uint8_t *bytes, const uint8_t *end,
+										uint32_t ord, uint32_t length){
+	c->remaining = length;
+	c->compressed = true;
+	c->ord = ord;
+	c->bytes = bytes;
+	c->end = end;
+}
 
-	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
-	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY){
-		RedisModule_CloseKey(key);
-		return;
+void posting_cursor_init(PostingCursor *c, const PostingList *pl, bool compressed){
+	uint32_t length = __atomic_load_n(&pl->length, __ATOMIC_ACQUIRE);
+	if (compressed){
+		if (pl->capacity == 0){
+			posting_cursor_bytes(c, NULL, NULL, 0, 0);
+			return;
+		}
+		uint64_t head = __atomic_load_n(POSTING_HEAD(pl), __ATOMIC_ACQUIRE);
+		const uint8_t *bytes = POSTING_BYTES(pl);
+		posting_cursor_bytes(c, bytes + (uint32_t)head, bytes + pl->capacity, head >> 32, length);
+	} else {
+		posting_cursor_arrays(c, POSTING_ORDS(pl), POSTING_POS(pl), length);
+	}
+}
+
+static inline bool posting_next(PostingCursor *c, uint32_t *ord, uint32_t *pos){
+	if (c->compressed){
+		if (c->bytes == c->end) return false;
+		uint32_t delta;
+		c->bytes = varint_decode(c->bytes, &delta);
+		c->bytes = varint_decode(c->bytes, pos);
+		*ord = c->ord;
+		c->ord -= delta;
+		return true;
 	}
+	if (c->remaining == 0) return false;
+	c->remaining--;
+	*ord = c->ords[c->remaining];
+	*pos = c->positions[c->remaining];
+	return true;
+}
 
-	RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS, descr_field, descr, NULL);
-	RedisModule_CloseKey(key);
+size_t posting_list_mem(const PostingList *pl, bool compressed){
+	return sizeof(PostingList) + ((compressed) ? sizeof(uint64_t) + pl->capacity : 2*pl->capacity*sizeof(uint32_t));
 }
 
-void DeleteDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
-	string idstr = RedisModule_StringPtrLen(keystr, NULL);
-	idstr += ":" + to_string(id);
+/* an empty list, with capacity bytes of room for a compressed one */
+static PostingList* posting_list_new(uint32_t capacity, bool compressed){
+	size_t size = sizeof(PostingList) + ((compressed) ? sizeof(uint64_t) + capacity : 2*capacity*sizeof(uint32_t));
+	PostingList *pl = (PostingList*)RedisModule_Alloc(size);
+	pl->length = 0;
+	pl->capacity = capacity;
+	if (compressed) __atomic_store_n(POSTING_HEAD(pl), HEAD_WORD(0, capacity), __ATOMIC_RELAXED);
+	return pl;
+}
 
-	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
-	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
-		RedisModule_CloseKey(key);
-		return;
+/* publish a new list for the slot and retire the one it replaces */
+static void replace_postings(ASIndex *index, FrameSlot *slot, PostingList *pl){
+	bool compressed = index->flags & AS_INDEX_COMPRESSED;
+	PostingList *old = slot->postings;
+	__atomic_store_n(&slot->postings, pl, __ATOMIC_RELEASE);
+	if (pl != &empty_postings)
+		index->postings_bytes += posting_list_mem(pl, compressed);
+	if (old != NULL && old != &empty_postings){
+		index->postings_bytes -= posting_list_mem(old, compressed);
+		retire_index_mem(index, old, free_mem);
 	}
+}
 
-	RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS, descr_field, REDISMODULE_HASH_DELETE, NULL);
-	RedisModule_CloseKey(key);
+/* encode a compressed list for the slot from postings sorted by */
+/* descending ord, there must be at least one                     */
+static void encode_postings(ASIndex *index, FrameSlot *slot, const vector<pair<uint32_t,uint32_t>> &postings){
+	size_t n = postings.size();
+	uint32_t nbytes = 0;
+	for (size_t i=0;i < n;i++){
+		uint32_t delta = (i + 1 < n) ? postings[i].first - postings[i+1].first : 0;
+		nbytes += varint_size(delta) + varint_size(postings[i].second);
+	}
+
+	PostingList *pl = posting_list_new(nbytes, true);
+	pl->length = n;
+	uint8_t *p = POSTING_BYTES(pl);
+	for (size_t i=0;i < n;i++){
+		p = varint_encode(p, (i + 1 < n) ? postings[i].first - postings[i+1].first : 0);
+		p = varint_encode(p, postings[i].second);
+	}
+	__atomic_store_n(POSTING_HEAD(pl), HEAD_WORD(postings[0].first, 0), __ATOMIC_RELAXED);
+	replace_postings(index, slot, pl);
 }
 
-void DeleteDescriptionKey(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
-	string idstr = RedisModule_StringPtrLen(keystr, NULL);
-	idstr += ":" + to_string(id);
+static void decode_postings(const PostingList *pl, vector<pair<uint32_t,uint32_t>> &postings){
+	PostingCursor c;
+	posting_cursor_init(&c, pl, true);
+	uint32_t ord, pos;
+	while (posting_next(&c, &ord, &pos))
+		postings.push_back({ord, pos});
+}
 
-	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
-	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
-		RedisModule_CloseKey(key);
+/* add a (ord, pos) posting to the slot's list.  A list with room   */
+/* is added to in place, otherwise a list twice the size replaces    */
+/* it, so adds take constant time on average whatever the encoding.  */
+void add_posting(ASIndex *index, FrameSlot *slot, uint32_t ord, uint32_t pos){
+	PostingList *pl = (slot->postings) ? slot->postings : &empty_postings;
+	if (index->flags & AS_INDEX_COMPRESSED){
+		uint64_t head = (pl->capacity) ? __atomic_load_n(POSTING_HEAD(pl), __ATOMIC_RELAXED) : HEAD_WORD(0, 0);
+		uint32_t first = head >> 32, start = (uint32_t)head;
+		if (pl->length > 0 && ord < first){
+			// out of order ordinal, insert in sorted place
+			vector<pair<uint32_t,uint32_t>> postings;
+			decode_postings(pl, postings);
+			size_t i = 0;
+			while (i < postings.size() && postings[i].first > ord) i++;
+			postings.insert(postings.begin() + i, {ord, pos});
+			encode_postings(index, slot, postings);
+			return;
+		}
+
+		// the new first entry, coded against the old first ord
+		uint8_t entry[10];
+		uint8_t *p = varint_encode(entry, (pl->length > 0) ? ord - first : 0);
+		p = varint_encode(p, pos);
+		uint32_t entry_len = p - entry;
+		if (entry_len > start){
+			// no room in front, move the entries to the back of a larger list
+			uint32_t used = pl->capacity - start;
+			uint32_t capacity = max(2*(used + entry_len), 16U);
+			PostingList *npl = posting_list_new(capacity, true);
+			memcpy(POSTING_BYTES(npl) + capacity - used, POSTING_BYTES(pl) + start, used);
+			start = capacity - used - entry_len;
+			memcpy(POSTING_BYTES(npl) + start, entry, entry_len);
+			__atomic_store_n(POSTING_HEAD(npl), HEAD_WORD(ord, start), __ATOMIC_RELAXED);
+			npl->length = pl->length + 1;
+			replace_postings(index, slot, npl);
+			return;
+		}
+		start -= entry_len;
+		memcpy(POSTING_BYTES(pl) + start, entry, entry_len);
+		__atomic_store_n(POSTING_HEAD(pl), HEAD_WORD(ord, start), __ATOMIC_RELEASE);
+		__atomic_store_n(&pl->length, pl->length + 1, __ATOMIC_RELEASE);
 		return;
 	}
 
-	RedisModule_DeleteKey(key);
-	RedisModule_CloseKey(key);
+	if (pl->length == pl->capacity){
+		uint32_t capacity = (pl->capacity) ? 2*pl->capacity : 1;
+		PostingList *npl = posting_list_new(capacity, false);
+		memcpy(POSTING_ORDS(npl), POSTING_ORDS(pl), pl->length*sizeof(uint32_t));
+		memcpy(POSTING_POS(npl), POSTING_POS(pl), pl->length*sizeof(uint32_t));
+		POSTING_ORDS(npl)[pl->length] = ord;
+		POSTING_POS(npl)[pl->length] = pos;
+		npl->length = pl->length + 1;
+		replace_postings(index, slot, npl);
+		return;
+	}
+	POSTING_ORDS(pl)[pl->length] = ord;
+	POSTING_POS(pl)[pl->length] = pos;
+	__atomic_store_n(&pl->length, pl->length + 1, __ATOMIC_RELEASE);
 }
 
-void DeleteCounterKey(RedisModuleCtx *ctx, RedisModuleString *keystr){
-	string counterstr = RedisModule_StringPtrLen(keystr, NULL);
-	counterstr += ":counter";
+/*------------------- Index views -----------------------------------*/
+
+/* publish the index's current parts for worker lookups, and retire */
+/* the previous view along with what only it still reached          */
+void publish_view(ASIndex *index){
+	IndexView *view = (IndexView*)RedisModule_Alloc(sizeof(IndexView) + index->n_segments*sizeof(Segment*));
+	view->flags = index->flags;
+	view->delta = index->delta;
+	view->frozen = index->frozen;
+	memcpy(view->mih, index->mih, sizeof(view->mih));
+	view->tracks = index->tracks;
+	view->n_tracks = index->n_tracks;
+	view->n_segments = index->n_segments;
+	if (index->n_segments > 0)
+		memcpy(view->segments, index->segments, index->n_segments*sizeof(Segment*));
+
+	IndexView *old = index->view;
+	__atomic_store_n(&index->view, view, __ATOMIC_SEQ_CST);
+	if (old != NULL) retire_index_mem(index, old, free_mem);
+	for (uint32_t i=0;i < index->n_unlinked;i++)
+		retire(index->unlinked[i].ptr, index->unlinked[i].free);
+	index->n_unlinked = 0;
+}
 
-	RedisModuleString *keycounterstr = RedisModule_CreateString(ctx, counterstr.c_str(), counterstr.length());
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keycounterstr, REDISMODULE_WRITE);
-	RedisModule_DeleteKey(key);
-	RedisModule_CloseKey(key);
-	return;
+/*------------------- Read segments ---------------------------------*/
+
+/* point a cursor at the postings of the i'th key */
+static inline void segment_cursor(const Segment *seg, uint64_t i, bool compressed, PostingCursor *c){
+	uint64_t off = seg->offsets[i];
+	if (compressed){
+		uint32_t count, ord;
+		const uint8_t *p = varint_decode(seg->bytes + off, &count);
+		p = varint_decode(p, &ord);
+		posting_cursor_bytes(c, p, seg->bytes + seg->offsets[i+1], ord, count);
+	} else {
+		posting_cursor_arrays(c, seg->ords + off, seg->positions + off, seg->offsets[i+1] - off);
+	}
 }
 
-void DeleteKey(RedisModuleCtx *ctx, RedisModuleString *keystr){
-	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_WRITE);
-	RedisModule_DeleteKey(key);
-	RedisModule_CloseKey(key);
-	return;
+/* Each filter block is 256 bits, 32 byte aligned so that it lies in */
+/* one cache line, and a key sets one bit in each of its 8 words.     */
+/* At SEGMENT_FILTER_BITS bits a key, about 1% of absent keys pass.   */
+/* Built with it 0, every key passes, to time lookups without it.     */
+static const uint32_t filter_salt[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+										0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+/* the filter block of key, and in x the hash picking its bits */
+static inline uint32_t* filter_block(const Segment *seg, uint32_t key, uint32_t *x){
+	uint64_t h = (uint64_t)key*0xff51afd7ed558ccdULL;
+	*x = (uint32_t)h;
+	return seg->filter + 8*(((h >> 32)*seg->n_blocks) >> 32);
 }
 
-/* ------------------ Auscout type methods --------------------------*/
+static void segment_build_filter(Segment *seg){
+	seg->n_blocks = ((seg->n_keys + seg->n_stops)*SEGMENT_FILTER_BITS + 255)/256;
+	if (seg->n_blocks == 0) seg->n_blocks = 1;
+	size_t size = seg->n_blocks*8*sizeof(uint32_t);
+	seg->filter_mem = RedisModule_Calloc(1, size + 32);
+	seg->filter = (uint32_t*)(((uintptr_t)seg->filter_mem + 31) & ~(uintptr_t)31);
+	for (uint64_t i=0;i < seg->n_keys + seg->n_stops;i++){
+		uint32_t x;
+		uint32_t key = (i < seg->n_keys) ? seg->keys[i] : seg->stops[i - seg->n_keys];
+		uint32_t *block = filter_block(seg, key, &x);
+		for (int w=0;w < 8;w++)
+			block[w] |= 1U << ((x*filter_salt[w]) >> 27);
+	}
+}
 
-extern "C" void* ASIndexTypeRdbLoad(RedisModuleIO *rdb, int encver){
-	if (encver != AUSCOUT_ENCODING_VERSION){
-		RedisModule_LogIOError(rdb, "warning", "rdbload: unable to encode for encver %d", encver);
-		return NULL;
+/* false if key is certainly not in the segment */
+static inline bool segment_may_hold(const Segment *seg, uint32_t key){
+	if (SEGMENT_FILTER_BITS == 0) return true;
+	uint32_t x;
+	const uint32_t *block = filter_block(seg, key, &x);
+	for (int w=0;w < 8;w++){
+		if (!((block[w] >> ((x*filter_salt[w]) >> 27)) & 1)) return false;
 	}
+	return true;
+}
 
-	ASIndex *index = (ASIndex*)RedisModule_Alloc(sizeof(ASIndex));
-	index->hash_dict = RedisModule_CreateDict(NULL); 
-	index->id_dict = RedisModule_CreateDict(NULL);
-	index->n_entries = 0;
+/* find key in a segment and point a cursor at its postings */
+bool segment_find(const Segment *seg, uint32_t key, bool compressed, PostingCursor *c){
+	if (!segment_may_hold(seg, key)) return false;
+	uint64_t bucket = (uint64_t)key >> (32 - seg->dir_bits);
+	const uint32_t *first = seg->keys + seg->dir[bucket];
+	const uint32_t *last = seg->keys + seg->dir[bucket+1];
+	const uint32_t *k = lower_bound(first, last, key);
+	if (k == last || *k != key) return false;
+	segment_cursor(seg, k - seg->keys, compressed, c);
+	return true;
+}
 
-	uint64_t n_ids = RedisModule_LoadUnsigned(rdb);
-	for (uint64_t i=0;i < n_ids;i++){
+/* true if the merge that built the segment dropped key as a stop frame */
+static inline bool segment_stopped(const Segment *seg, uint32_t key){
+	return seg->n_stops > 0 && binary_search(seg->stops, seg->stops + seg->n_stops, key);
+}
 
-		int64_t id = RedisModule_LoadSigned(rdb);
-		uint32_t n_frames = (int32_t)RedisModule_LoadUnsigned(rdb);
-		index->n_entries += n_frames;
+size_t segment_mem(const Segment *seg){
+	return sizeof(Segment) + seg->n_keys*(sizeof(uint32_t) + sizeof(uint64_t)) + sizeof(uint64_t)
+		+ seg->n_stops*sizeof(uint32_t)
+		+ ((1ULL << seg->dir_bits) + 1)*sizeof(uint32_t) + seg->n_blocks*8*sizeof(uint32_t) + 32
+		+ (seg->bytes ? seg->n_bytes : 2*seg->n_postings*sizeof(uint32_t));
+}
 
-		EntryList *list = (EntryList*)RedisModule_Calloc(1, sizeof(EntryList));
-		RedisModule_DictSetC(index->id_dict, &id, sizeof(id), list);
-		index->n_entries += n_frames;
+void segment_free(Segment *seg){
+	RedisModule_Free(seg->keys);
+	RedisModule_Free(seg->offsets);
+	RedisModule_Free(seg->dir);
+	RedisModule_Free(seg->ords);
+	RedisModule_Free(seg->positions);
+	RedisModule_Free(seg->bytes);
+	RedisModule_Free(seg->filter_mem);
+	RedisModule_Free(seg->stops);
+	RedisModule_Free(seg);
+}
 
-		Entry *curr = NULL;
-		for (uint32_t j=0;j<n_frames;j++){
-			if (j == 0){
-				list->head = curr = (Entry*)RedisModule_Calloc(1, sizeof(Entry));
-				list->length = n_frames;
-			} else {
-				curr->succ = (Entry*)RedisModule_Calloc(1, sizeof(Entry));
-				curr = curr->succ;
-			}
-			curr->id = id;
-			curr->hash_value = (uint32_t)RedisModule_LoadUnsigned(rdb);
-			curr->pos = (uint32_t)RedisModule_LoadSigned(rdb);
-			add_entry(index->hash_dict, curr->hash_value, curr);
-		}
+/* release a delta table and its posting lists */
+void frozen_table_free(FrameTable *table){
+	uint64_t cursor = 0;
+	FrameSlot *slot = NULL;
+	while ((slot = frame_table_next(table, &cursor)) != NULL){
+		RedisModule_Free(slot->postings);
 	}
+	frame_table_free(table);
+}
 
-	return index;
+static void free_segment_mem(void *ptr){
+	segment_free((Segment*)ptr);
 }
 
-extern "C" void ASIndexTypeRdbSave(RedisModuleIO *rdb, void *value){
-	ASIndex *index = (ASIndex*)value;
-	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
-	unsigned char *dict_key = NULL;
-	size_t keylen;
-	EntryList *list = NULL;
+static void free_frozen_mem(void *ptr){
+	frozen_table_free((FrameTable*)ptr);
+}
 
-	uint64_t n_ids = RedisModule_DictSize(index->id_dict);
-	RedisModule_SaveUnsigned(rdb, n_ids);
-	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
-		uint64_t nframes = list->length;
-		int64_t id = list->head->id;
-		RedisModule_SaveSigned(rdb, id);
-		RedisModule_SaveUnsigned(rdb, nframes);
-		uint32_t i = 0;
-		Entry *entry = list->head;
-		while (entry != NULL && i < nframes){
-			uint64_t tmphash = (uint64_t)entry->hash_value;
-			int64_t pos = (int64_t)entry->pos;
-			RedisModule_SaveUnsigned(rdb, tmphash);
-			RedisModule_SaveSigned(rdb, pos);
-			entry = entry->succ;
-			i++;
-		}
+static void* shrink_alloc(void *ptr, size_t size){
+	if (size == 0){
+		RedisModule_Free(ptr);
+		return NULL;
 	}
+	return RedisModule_Realloc(ptr, size);
 }
 
-extern "C" void ASIndexTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value){
-	ASIndex *index = (ASIndex*)value;
-	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
-	unsigned char *dict_key = NULL;
-	size_t keylen;
-	EntryList *list = NULL;
-
-	vector<uint32_t> hashesforid;
-	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
-		Entry *entry = list->head;
-		int64_t id = entry->id;
-		while (entry != NULL){
-			hashesforid.push_back(htonl(entry->hash_value));
-			entry->succ;
-		}
-		
-		RedisModule_EmitAOF(aof, "auscout.add", "sbl",
-					 key, (unsigned char*)hashesforid.data(), hashesforid.size()*sizeof(uint32_t), id);
-		hashesforid.clear();
+static void segment_build_dir(Segment *seg){
+	uint32_t bits = 0;
+	while (bits < SEGMENT_DIR_MAX_BITS && (2ULL << bits) <= seg->n_keys) bits++;
+	uint64_t n_buckets = 1ULL << bits;
+	seg->dir_bits = bits;
+	seg->dir = (uint32_t*)RedisModule_Alloc((n_buckets + 1)*sizeof(uint32_t));
+	uint64_t k = 0;
+	for (uint64_t b=0;b < n_buckets;b++){
+		while (k < seg->n_keys && ((uint64_t)seg->keys[k] >> (32 - bits)) < b) k++;
+		seg->dir[b] = k;
 	}
+	seg->dir[n_buckets] = seg->n_keys;
 }
 
-extern "C" void ASIndexTypeFree(void *value){
-	ASIndex *index = (ASIndex*)value;
-	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
-	unsigned char *dict_key = NULL;
-	size_t keylen;
-	EntryList *list = NULL;
-	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
-		Entry *entry = list->head;
-		while (entry != NULL){
-			Entry *tmp = entry;
-			entry = entry->succ;
-			remove_entry(index->hash_dict, tmp->hash_value, tmp);
-			RedisModule_Free(tmp);
+/* With the STOPFRAMES module option, hash values with more than      */
+/* stop_postings postings in the index, such as silence or a steady   */
+/* tone, are stop frames.  Lookups skip them: they match nearly every */
+/* track, and only the few most recently added would be scored.  With */
+/* STOPDROP, a merge also drops the postings of a hash value that has */
+/* more than stop_postings of them in its output, or that one of its  */
+/* inputs dropped, and lists the value in the output's stops, as does */
+/* a segment built of added or loaded tracks.  A dropped stop frame   */
+/* stays one until the index is reloaded.                             */
+static uint64_t stop_postings = 0;      // 0 for no stop frames
+static bool stop_drop = false;
+
+/* append key and its postings, sorted by ord, to a segment being */
+/* built, counting them in n_keys, n_postings and n_bytes           */
+static void segment_append(Segment *seg, uint32_t key, const vector<pair<uint32_t,uint32_t>> &postings,
+						   bool compressed){
+	seg->keys[seg->n_keys] = key;
+	if (compressed){
+		seg->offsets[seg->n_keys] = seg->n_bytes;
+		uint8_t *p = varint_encode(seg->bytes + seg->n_bytes, postings.size());
+		p = varint_encode(p, postings.back().first);
+		for (size_t i=postings.size();i-- > 0;){
+			p = varint_encode(p, (i > 0) ? postings[i].first - postings[i-1].first : 0);
+			p = varint_encode(p, postings[i].second);
+		}
+		seg->n_bytes = p - seg->bytes;
+		seg->n_postings += postings.size();
+	} else {
+		seg->offsets[seg->n_keys] = seg->n_postings;
+		for (auto &posting : postings){
+			seg->ords[seg->n_postings] = posting.first;
+			seg->positions[seg->n_postings] = posting.second;
+			seg->n_postings++;
 		}
-		RedisModule_Free(list);
 	}
+	seg->n_keys++;
+}
 
-	RedisModule_DictIteratorStop(iter);
-	RedisModule_FreeDict(NULL, index->hash_dict);
-	RedisModule_FreeDict(NULL, index->id_dict);
+/* trim a built segment's arrays to size and add its stops, */
+/* directory and filter                                     */
+static void segment_finish(Segment *seg, bool compressed, vector<uint32_t> &stops){
+	seg->offsets[seg->n_keys] = (compressed) ? seg->n_bytes : seg->n_postings;
+	seg->keys = (uint32_t*)shrink_alloc(seg->keys, seg->n_keys*sizeof(uint32_t));
+	seg->offsets = (uint64_t*)RedisModule_Realloc(seg->offsets, (seg->n_keys + 1)*sizeof(uint64_t));
+	if (compressed){
+		seg->bytes = (uint8_t*)shrink_alloc(seg->bytes, seg->n_bytes);
+	} else {
+		seg->ords = (uint32_t*)shrink_alloc(seg->ords, seg->n_postings*sizeof(uint32_t));
+		seg->positions = (uint32_t*)shrink_alloc(seg->positions, seg->n_postings*sizeof(uint32_t));
+	}
+	sort(stops.begin(), stops.end());
+	seg->n_stops = stops.size();
+	if (seg->n_stops > 0){
+		seg->stops = (uint32_t*)RedisModule_Alloc(seg->n_stops*sizeof(uint32_t));
+		memcpy(seg->stops, stops.data(), seg->n_stops*sizeof(uint32_t));
+	}
+	segment_build_dir(seg);
+	segment_build_filter(seg);
 }
 
-extern "C" size_t ASIndexTypeMemUsage(const void *value){
-	ASIndex *index = (ASIndex*)value;
-	uint64_t n_ids = RedisModule_DictSize(index->id_dict);
-	uint64_t n_hashes = RedisModule_DictSize(index->hash_dict);
-	size_t entries_sz = (index->n_entries)*sizeof(Entry);
-	size_t list_sz = (n_ids + n_hashes)*sizeof(EntryList);
-	size_t dict_sz = (n_ids + n_hashes)*sizeof(EntryList*);
-	return entries_sz + list_sz + dict_sz;;
+/* build the segment of n_tracks tracks added together, of ordinals  */
+/* ords, from their run length coded frames, as in Track.  Runs on a  */
+/* worker thread, see AddJob.                                         */
+Segment* build_tracks_segment(const uint32_t *ords, uint32_t *const *frames, const uint32_t *n_entries,
+							  uint32_t n_tracks, bool compressed){
+	// (key, ord) packed in the first half, so one sort orders all three
+	vector<pair<uint64_t,uint32_t>> entries;
+	for (uint32_t i=0;i < n_tracks;i++){
+		for (uint32_t j=0;j < n_entries[i];j++)
+			entries.push_back({((uint64_t)frames[i][j] << 32) | ords[i], frames[i][n_entries[i] + j]});
+	}
+	sort(entries.begin(), entries.end());
+	uint64_t n = entries.size();
+
+	Segment *seg = (Segment*)RedisModule_Calloc(1, sizeof(Segment));
+	seg->keys = (uint32_t*)RedisModule_Alloc((n + 1)*sizeof(uint32_t));
+	seg->offsets = (uint64_t*)RedisModule_Alloc((n + 1)*sizeof(uint64_t));
+	if (compressed){
+		seg->bytes = (uint8_t*)RedisModule_Alloc(20*n + 1);
+	} else {
+		seg->ords = (uint32_t*)RedisModule_Alloc((n + 1)*sizeof(uint32_t));
+		seg->positions = (uint32_t*)RedisModule_Alloc((n + 1)*sizeof(uint32_t));
+	}
+
+	vector<pair<uint32_t,uint32_t>> postings;
+	vector<uint32_t> stops;
+	for (uint64_t i=0;i < n;){
+		uint32_t key = entries[i].first >> 32;
+		postings.clear();
+		for (;i < n && (uint32_t)(entries[i].first >> 32) == key;i++)
+			postings.push_back({(uint32_t)entries[i].first, entries[i].second});
+		if (stop_drop && stop_postings > 0 && postings.size() > stop_postings){
+			stops.push_back(key);
+			continue;
+		}
+		segment_append(seg, key, postings, compressed);
+	}
+	segment_finish(seg, compressed, stops);
+	return seg;
 }
 
-extern "C" void ASIndexTypeDigest(RedisModuleDigest *digest, void *value){
-	REDISMODULE_NOT_USED(digest);
-	REDISMODULE_NOT_USED(value);
+/* one sorted input of a merge: the frozen delta's keys, sorted on  */
+/* the spot, or a segment's key array                               */
+typedef struct merge_source_t {
+	const Segment *seg;
+	vector<pair<uint32_t, const PostingList*>> lists;
+	uint64_t pos, n;
+} MergeSource;
+
+static inline uint32_t merge_source_key(const MergeSource &src){
+	return (src.seg) ? src.seg->keys[src.pos] : src.lists[src.pos].first;
 }
-/* -----------------DEBUGGING COMMANDS-----------------------------*/
 
-/* list all entries by id, a list of hashvalues for each id */
-/* ARGS: key */
-extern "C" int AuscoutList_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 2) return RedisModule_WrongArity(ctx);
+/* merge the frozen delta and the input segments into one segment,  */
+/* dropping the postings of tracks deleted when the job started     */
+Segment* merge_segments(MergeJob *job){
+	vector<MergeSource> sources(job->n_inputs + 1);
+	vector<uint32_t> stops;
+	uint64_t max_keys = 0, max_postings = 0, max_bytes = 0;
+	for (uint32_t i=0;i < job->n_inputs;i++){
+		stops.insert(stops.end(), job->inputs[i]->stops, job->inputs[i]->stops + job->inputs[i]->n_stops);
+		sources[i].seg = job->inputs[i];
+		sources[i].pos = 0;
+		sources[i].n = job->inputs[i]->n_keys;
+		max_keys += job->inputs[i]->n_keys;
+		max_postings += job->inputs[i]->n_postings;
+		max_bytes += job->inputs[i]->n_bytes;
+	}
 
-	ASIndex *index = NULL;
-	try {
-		index = GetIndex(ctx, argv[1]);
-		if (index == NULL) {
-			RedisModule_ReplyWithError(ctx, "ERR - no such key");
-			return REDISMODULE_ERR;
+	MergeSource &delta = sources[job->n_inputs];
+	delta.seg = NULL;
+	delta.pos = 0;
+	if (job->frozen){
+		uint64_t cursor = 0;
+		FrameSlot *slot = NULL;
+		while ((slot = frame_table_next(job->frozen, &cursor)) != NULL){
+			delta.lists.push_back({slot->key, slot->postings});
+			max_postings += slot->postings->length;
+			max_bytes += slot->postings->capacity + 10;
 		}
-	} catch (int &e){
-		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
-		return REDISMODULE_ERR;
+		sort(delta.lists.begin(), delta.lists.end());
+	}
+	delta.n = delta.lists.size();
+	max_keys += delta.n;
+	sort(stops.begin(), stops.end());
+	stops.erase(unique(stops.begin(), stops.end()), stops.end());
+	size_t n_inherited = stops.size(), next_stop = 0;
+	max_bytes += 10*max_keys;  // room for the count and first ord varints
+
+	Segment *seg = (Segment*)RedisModule_Calloc(1, sizeof(Segment));
+	seg->keys = (uint32_t*)RedisModule_Alloc((max_keys + 1)*sizeof(uint32_t));
+	seg->offsets = (uint64_t*)RedisModule_Alloc((max_keys + 1)*sizeof(uint64_t));
+	if (job->compressed){
+		seg->bytes = (uint8_t*)RedisModule_Alloc(max_bytes + 1);
+	} else {
+		seg->ords = (uint32_t*)RedisModule_Alloc((max_postings + 1)*sizeof(uint32_t));
+		seg->positions = (uint32_t*)RedisModule_Alloc((max_postings + 1)*sizeof(uint32_t));
+	}
+
+	vector<pair<uint32_t,uint32_t>> postings;
+	while (true){
+		bool any = false;
+		uint32_t key = 0;
+		for (MergeSource &src : sources){
+			if (src.pos == src.n) continue;
+			uint32_t k = merge_source_key(src);
+			if (!any || k < key) key = k;
+			any = true;
+		}
+		if (!any) break;
+
+		postings.clear();
+		for (MergeSource &src : sources){
+			if (src.pos == src.n || merge_source_key(src) != key) continue;
+			PostingCursor c;
+			if (src.seg)
+				segment_cursor(src.seg, src.pos, job->compressed, &c);
+			else
+				posting_cursor_init(&c, src.lists[src.pos].second, job->compressed);
+			src.pos++;
+
+			uint32_t ord, pos;
+			while (posting_next(&c, &ord, &pos)){
+				if (ord < job->n_ords && (job->dead[ord >> 3] >> (ord & 7)) & 1){
+					job->purged++;
+					continue;
+				}
+				postings.push_back({ord, pos});
+			}
+		}
+		if (postings.empty()) continue;
+		while (next_stop < n_inherited && stops[next_stop] < key) next_stop++;
+		if (next_stop < n_inherited && stops[next_stop] == key) continue;
+		if (stop_drop && stop_postings > 0 && postings.size() > stop_postings){
+			stops.push_back(key);
+			continue;
+		}
+		sort(postings.begin(), postings.end());
+		segment_append(seg, key, postings, job->compressed);
+	}
+	segment_finish(seg, job->compressed, stops);
+	return seg;
+}
+
+/*------------------- Background merges -----------------------------*/
+
+static set<ASIndex*> live_indices;       // indices checked by the maintenance timer
+static vector<MergeJob*> orphaned_merges; // merges whose index was freed
+
+static void* merge_thread(void *arg){
+	MergeJob *job = (MergeJob*)arg;
+	job->output = merge_segments(job);
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void merge_job_free(MergeJob *job){
+	RedisModule_Free(job->inputs);
+	RedisModule_Free(job->dead);
+	RedisModule_Free(job);
+}
+
+/* freeze the delta and merge it, along with the newest run of      */
+/* segments no larger than twice what is merged so far, so segment  */
+/* sizes grow geometrically.  With an empty delta the run starts    */
+/* with the newest two segments.  full merges every segment, to     */
+/* purge the postings of deleted tracks.                            */
+void start_merge(ASIndex *index, bool full){
+	uint64_t acc = index->delta_entries;
+	uint32_t first = index->n_segments;
+	uint32_t min_inputs = (acc == 0) ? 2 : 0;
+	while (first > 0 && (full || index->n_segments - first < min_inputs
+						 || index->segments[first-1]->n_postings <= 2*acc)){
+		acc += index->segments[first-1]->n_postings;
+		first--;
+	}
+	uint32_t n_inputs = index->n_segments - first;
+	if (index->delta_entries == 0 && n_inputs < ((full) ? 1 : 2))
+		return;
+
+	MergeJob *job = (MergeJob*)RedisModule_Calloc(1, sizeof(MergeJob));
+	job->index = index;
+	job->compressed = index->flags & AS_INDEX_COMPRESSED;
+	job->full = first == 0;
+	job->dead_entries = index->dead_entries;
+	job->first = first;
+	job->n_inputs = n_inputs;
+	job->inputs = (Segment**)RedisModule_Alloc((n_inputs + 1)*sizeof(Segment*));
+	if (n_inputs > 0)
+		memcpy(job->inputs, index->segments + first, n_inputs*sizeof(Segment*));
+
+	if (index->delta_entries > 0){
+		job->frozen = index->delta;
+		index->delta = frame_table_new(FRAME_TABLE_MIN_CAPACITY);
+		index->frozen = job->frozen;
+		index->frozen_bytes = index->postings_bytes;
+		index->postings_bytes = 0;
+		index->delta_entries = 0;
+		publish_view(index);
+	}
+
+	job->n_ords = index->n_tracks;
+	job->dead = (uint8_t*)RedisModule_Calloc(job->n_ords/8 + 1, 1);
+	for (uint32_t ord=0;ord < job->n_ords;ord++){
+		if (index->tracks[ord].flags & TRACK_DELETED)
+			job->dead[ord >> 3] |= 1 << (ord & 7);
+	}
+
+	index->merge = job;
+	if (pthread_create(&job->thread, NULL, merge_thread, job) != 0){
+		// no thread to spare, merge in place
+		merge_thread(job);
+		job->thread = pthread_self();
+	}
+}
+
+/* swap the output of a finished merge in for its inputs */
+void finish_merge(MergeJob *job){
+	if (!pthread_equal(job->thread, pthread_self()))
+		pthread_join(job->thread, NULL);
+
+	ASIndex *index = job->index;
+	if (index == NULL){
+		for (uint32_t i=0;i < job->n_inputs;i++)
+			segment_free(job->inputs[i]);
+		if (job->frozen) frozen_table_free(job->frozen);
+		segment_free(job->output);
+		merge_job_free(job);
+		return;
+	}
+
+	uint32_t n_out = (job->output->n_keys > 0 || job->output->n_stops > 0) ? 1 : 0;
+	uint32_t n_after = index->n_segments - job->first - job->n_inputs;
+	uint32_t n_segments = job->first + n_out + n_after;
+	if (n_segments > index->n_segments)
+		index->segments = (Segment**)RedisModule_Realloc(index->segments, n_segments*sizeof(Segment*));
+	memmove(index->segments + job->first + n_out, index->segments + job->first + job->n_inputs,
+			n_after*sizeof(Segment*));
+	if (n_out)
+		index->segments[job->first] = job->output;
+	else
+		segment_free(job->output);
+	index->n_segments = n_segments;
+	index->segments = (Segment**)shrink_alloc(index->segments, n_segments*sizeof(Segment*));
+
+	index->frozen = NULL;
+	index->frozen_bytes = 0;
+	// merging every segment purges whatever was dead at the start,
+	// also in the postings of stop frames dropped earlier
+	index->dead_entries -= (job->full) ? job->dead_entries : job->purged;
+	index->merge = NULL;
+	publish_view(index);
+
+	// lookups from now on cannot reach the inputs
+	for (uint32_t i=0;i < job->n_inputs;i++)
+		retire_index_mem(index, job->inputs[i], free_segment_mem);
+	if (job->frozen) retire_index_mem(index, job->frozen, free_frozen_mem);
+	merge_job_free(job);
+}
+
+/* a delta is merged once it is large, or has not been added to for */
+/* a while, and the newest segments once long adds have left too    */
+/* many; segments are purged once a quarter of their postings       */
+/* belong to deleted tracks                                         */
+void expire_sessions(ASIndex *index, long long now);
+
+void maintain_index(ASIndex *index, long long now){
+	expire_sessions(index, now);
+	if (index->merge){
+		if (!__atomic_load_n(&index->merge->done, __ATOMIC_ACQUIRE)) return;
+		finish_merge(index->merge);
+	}
+
+	bool purge = index->dead_entries >= MERGE_DELTA_ENTRIES && 4*index->dead_entries >= index->n_entries;
+	if (purge || index->delta_entries >= MERGE_DELTA_ENTRIES
+		|| (index->delta_entries > 0 && now - index->last_add >= MERGE_DELTA_IDLE)
+		|| index->n_segments > MERGE_SEGMENTS_MAX)
+		start_merge(index, purge);
+}
+
+extern "C" void MaintenanceTimer(RedisModuleCtx *ctx, void *data){
+	long long now = RedisModule_Milliseconds();
+	for (ASIndex *index : live_indices)
+		maintain_index(index, now);
+
+	for (size_t i=0;i < orphaned_merges.size();){
+		if (__atomic_load_n(&orphaned_merges[i]->done, __ATOMIC_ACQUIRE)){
+			finish_merge(orphaned_merges[i]);
+			orphaned_merges.erase(orphaned_merges.begin() + i);
+		} else {
+			i++;
+		}
+	}
+	reclaim_retired();
+
+	RedisModule_CreateTimer(ctx, MERGE_TIMER_PERIOD, MaintenanceTimer, data);
+}
+
+/*------------------- Multi-index hashing ---------------------------*/
+
+/* An index created with MIH m also splits each distinct hash value  */
+/* into m substrings of about 32/m bits, and lists the value under   */
+/* each substring in that substring's table.  A value within r bits  */
+/* of a query frame has some substring within r/m bits of the        */
+/* query's, so a radius lookup only probes the substrings that close */
+/* and verifies the listed values on the whole frame.  The lists use */
+/* the PostingList header, with data holding the values.  Values are */
+/* never taken out of the lists: those of deleted tracks just probe  */
+/* nothing, until the index is reloaded.                             */
+
+/* migrate a few more slots of a grown table, and release the table */
+/* it migrated from once it is done.  shared tables are read by      */
+/* worker lookups, which may still be probing the old one.           */
+static void migrate_table(ASIndex *index, FrameTable *table, bool shared){
+	FrameTable *old = frame_table_migrate(table, FRAME_TABLE_MIGRATE_STEPS);
+	if (old == NULL) return;
+	if (shared)
+		retire_index_mem(index, old, free_mem);
+	else
+		frame_table_free(old);
+}
+
+/* replace a full table with a larger one to take extra more keys,   */
+/* finishing any migration still pending first.  That only happens   */
+/* when it is grown ahead of a bulk add - one migration is done long */
+/* before inserts fill the table again.                              */
+static void grow_table(ASIndex *index, FrameTable **table, uint64_t extra, bool shared){
+	FrameTable *old = frame_table_migrate(*table, UINT64_MAX);
+	if (old != NULL){
+		if (shared)
+			retire_index_mem(index, old, free_mem);
+		else
+			frame_table_free(old);
+	}
+	*table = frame_table_grow(*table, extra);
+	if (shared) publish_view(index);
+}
+
+/* marks a value in mih_values */
+static PostingList mih_value_marker = { 0, 0 };
+
+/* the low bit and width of substring j of m */
+static inline void mih_substring(uint32_t m, uint32_t j, uint32_t *shift, uint32_t *bits){
+	*shift = 32*j/m;
+	*bits = 32*(j + 1)/m - *shift;
+}
+
+size_t value_list_mem(const PostingList *pl){
+	return sizeof(PostingList) + pl->capacity*sizeof(uint32_t);
+}
+
+/* append value to the slot's list, in place if it has room */
+static void value_list_add(ASIndex *index, FrameSlot *slot, uint32_t value){
+	PostingList *pl = (slot->postings) ? slot->postings : &empty_postings;
+	if (pl->length == pl->capacity){
+		uint32_t capacity = (pl->capacity) ? 2*pl->capacity : 2;
+		PostingList *npl = (PostingList*)RedisModule_Alloc(sizeof(PostingList) + capacity*sizeof(uint32_t));
+		npl->capacity = capacity;
+		memcpy(npl->data, pl->data, pl->length*sizeof(uint32_t));
+		npl->data[pl->length] = value;
+		npl->length = pl->length + 1;
+		__atomic_store_n(&slot->postings, npl, __ATOMIC_RELEASE);
+		index->mih_bytes += value_list_mem(npl);
+		if (pl != &empty_postings){
+			index->mih_bytes -= value_list_mem(pl);
+			retire_index_mem(index, pl, free_mem);
+		}
+		return;
+	}
+	pl->data[pl->length] = value;
+	__atomic_store_n(&pl->length, pl->length + 1, __ATOMIC_RELEASE);
+}
+
+/* list a hash value new to the index under each of its substrings */
+void mih_add_value(ASIndex *index, uint32_t value){
+	if (frame_table_full(index->mih_values))
+		grow_table(index, &index->mih_values, 0, false);
+	FrameSlot *seen = frame_table_insert(index->mih_values, value);
+	bool listed = seen->postings != NULL;
+	seen->postings = &mih_value_marker;
+	migrate_table(index, index->mih_values, false);
+	if (listed) return;
+
+	uint32_t m = AS_INDEX_MIH_TABLES(index->flags);
+	for (uint32_t j=0;j < m;j++){
+		if (frame_table_full(index->mih[j]))
+			grow_table(index, &index->mih[j], 0, true);
+		uint32_t shift, bits;
+		mih_substring(m, j, &shift, &bits);
+		FrameSlot *slot = frame_table_insert(index->mih[j], (value >> shift) & ((1U << bits) - 1));
+		value_list_add(index, slot, value);
+		migrate_table(index, index->mih[j], true);
+	}
+}
+
+/*------------------- Delta updates ---------------------------------*/
+
+/* grow the delta ahead of a bulk add of up to n_keys new keys.   */
+/* At most DELTA_RESERVE_MAX are reserved, the delta only holds   */
+/* so many between merges, and add_entry grows it past them.      */
+void reserve_delta(ASIndex *index, uint64_t n_keys){
+	FrameTable *delta = index->delta;
+	n_keys = min(n_keys, (uint64_t)DELTA_RESERVE_MAX);
+	if (8*(delta->size + delta->pending + n_keys) > 7*frame_table_capacity(delta))
+		grow_table(index, &index->delta, n_keys, true);
+}
+
+void add_entry(ASIndex *index, uint32_t hashframe, uint32_t ord, uint32_t pos){
+	if (frame_table_full(index->delta)) grow_table(index, &index->delta, 0, true);
+	FrameSlot *slot = frame_table_insert(index->delta, hashframe);
+	add_posting(index, slot, ord, pos);
+	migrate_table(index, index->delta, true);
+	index->delta_entries++;
+	if (index->mih_values != NULL) mih_add_value(index, hashframe);
+}
+
+/* remove a posting from the delta, returns false if it is not there */
+/* - it has already been merged into a read segment                 */
+bool remove_entry(ASIndex *index, uint32_t hashframe, uint32_t ord, uint32_t pos){
+	FrameSlot *slot = frame_table_find(index->delta, hashframe);
+	if (slot == NULL || slot->postings == &empty_postings) return false;
+	PostingList *pl = slot->postings;
+
+	if (index->flags & AS_INDEX_COMPRESSED){
+		vector<pair<uint32_t,uint32_t>> postings;
+		decode_postings(pl, postings);
+		for (size_t i=0;i < postings.size();i++){
+			if (postings[i].first == ord && postings[i].second == pos){
+				postings.erase(postings.begin() + i);
+				index->delta_entries--;
+				if (postings.empty()) // last posting, empty the key
+					replace_postings(index, slot, &empty_postings);
+				else
+					encode_postings(index, slot, postings);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t *ords = POSTING_ORDS(pl);
+	uint32_t *positions = POSTING_POS(pl);
+	for (uint32_t i=0;i < pl->length;i++){
+		if (ords[i] == ord && positions[i] == pos){
+			index->delta_entries--;
+			if (pl->length == 1){ // last posting, empty the key
+				replace_postings(index, slot, &empty_postings);
+				return true;
+			}
+			// copy the rest in insertion order
+			PostingList *npl = posting_list_new(pl->capacity, false);
+			uint32_t rest = pl->length - i - 1;
+			memcpy(POSTING_ORDS(npl), ords, i*sizeof(uint32_t));
+			memcpy(POSTING_ORDS(npl) + i, ords + i + 1, rest*sizeof(uint32_t));
+			memcpy(POSTING_POS(npl), positions, i*sizeof(uint32_t));
+			memcpy(POSTING_POS(npl) + i, positions + i + 1, rest*sizeof(uint32_t));
+			npl->length = pl->length - 1;
+			replace_postings(index, slot, npl);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* count the entries a hash array will occupy - consecutive repeated */
+/* frames are only indexed once                                      */
+uint32_t count_entries(const uint32_t *data, uint32_t n_frames){
+	uint32_t count = 0;
+	uint32_t prev_frame = 0;
+	for (uint32_t i=0;i < n_frames;i++){
+		uint32_t curr_frame = ntohl(data[i]);
+		if (curr_frame != prev_frame){
+			prev_frame = curr_frame;
+			count++;
+		}
+	}
+	return count;
+}
+
+/* run length code n_frames network order hash frames into hashes */
+/* and positions, sized by count_entries                          */
+void code_frames(const uint32_t *data, uint32_t n_frames, uint32_t *hashes, uint32_t *positions){
+	uint32_t count = 0;
+	uint32_t prev_frame = 0;
+	for (uint32_t i=0;i < n_frames;i++){
+		uint32_t curr_frame = ntohl(data[i]);
+		if (curr_frame != prev_frame){
+			hashes[count] = curr_frame;
+			positions[count] = i;
+			prev_frame = curr_frame;
+			count++;
+		}
+	}
+}
+
+ASIndex* new_index(uint32_t flags){
+	ASIndex *index = (ASIndex*)RedisModule_Calloc(1, sizeof(ASIndex));
+	index->flags = flags;
+	index->delta = frame_table_new(FRAME_TABLE_MIN_CAPACITY);
+	if (AS_INDEX_MIH_TABLES(flags) > 0){
+		index->mih_values = frame_table_new(FRAME_TABLE_MIN_CAPACITY);
+		for (uint32_t j=0;j < AS_INDEX_MIH_TABLES(flags);j++)
+			index->mih[j] = frame_table_new(FRAME_TABLE_MIN_CAPACITY);
+	}
+	index->id_dict = RedisModule_CreateDict(NULL);
+	index->next_id = 1;
+	publish_view(index);
+
+	live_indices.insert(index);
+	return index;
+}
+
+/* make room for n more tracks.  A full tracks array is copied,  */
+/* since the published view may still use it.                     */
+void reserve_tracks(ASIndex *index, uint32_t n){
+	if (index->n_tracks + n <= index->tracks_capacity) return;
+	uint32_t capacity = (index->tracks_capacity) ? 2*index->tracks_capacity : 16;
+	while (capacity < index->n_tracks + n) capacity *= 2;
+	Track *tracks = (Track*)RedisModule_Alloc(capacity*sizeof(Track));
+	if (index->n_tracks > 0)
+		memcpy(tracks, index->tracks, index->n_tracks*sizeof(Track));
+	if (index->tracks) retire_after_publish(index, index->tracks, free_mem);
+	index->tracks = tracks;
+	index->tracks_capacity = capacity;
+}
+
+/* give id a track ordinal with a frames slab of n_entries,     */
+/* returns NULL if the id is already indexed                     */
+Track* new_track(ASIndex *index, int64_t id, uint32_t n_entries){
+	reserve_tracks(index, 1);
+	uint32_t ord = index->n_tracks;
+
+	if (RedisModule_DictSetC(index->id_dict, &id, sizeof(id), (void*)(uintptr_t)ord) == REDISMODULE_ERR)
+		return NULL;
+	index->n_tracks++;
+	// an id given by the caller is never handed out again
+	if (id >= index->next_id && id < INT64_MAX) index->next_id = id + 1;
+
+	Track *track = &index->tracks[ord];
+	track->id = id;
+	track->n_entries = n_entries;
+	track->flags = 0;
+	track->frames = (n_entries) ? (uint32_t*)RedisModule_Alloc(2*n_entries*sizeof(uint32_t)) : NULL;
+	return track;
+}
+
+/* reserve an ordinal for a track indexed on a worker.  It looks */
+/* like a deleted track until install_batch fills it in.         */
+uint32_t reserve_ordinal(ASIndex *index){
+	reserve_tracks(index, 1);
+	uint32_t ord = index->n_tracks++;
+	Track *track = &index->tracks[ord];
+	track->id = 0;
+	track->frames = NULL;
+	track->n_entries = 0;
+	track->flags = TRACK_DELETED;
+	return ord;
+}
+
+/* look up the ordinal for an id, returns false if no such id */
+bool get_track_ordinal(ASIndex *index, int64_t id, uint32_t *ord){
+	int nokey;
+	void *val = RedisModule_DictGetC(index->id_dict, &id, sizeof(id), &nokey);
+	if (nokey) return false;
+	*ord = (uint32_t)(uintptr_t)val;
+	return true;
+}
+
+/* remove the track's postings from the delta and release its slab. */
+/* Postings already merged into segments stay until a merge drops    */
+/* them, lookups skip them meanwhile.                                */
+void delete_track(ASIndex *index, uint32_t ord){
+	Track *track = &index->tracks[ord];
+	uint32_t *hashes = TRACK_HASHES(track);
+	uint32_t *positions = TRACK_POS(track);
+	for (uint32_t i=0;i < track->n_entries;i++){
+		if (!remove_entry(index, hashes[i], ord, positions[i]))
+			index->dead_entries++;
+	}
+
+	RedisModule_DictDelC(index->id_dict, &track->id, sizeof(track->id), NULL);
+	index->n_entries -= track->n_entries;
+	index->generation++;
+	uint32_t *frames = track->frames;
+	__atomic_store_n(&track->frames, (uint32_t*)NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&track->n_entries, 0, __ATOMIC_RELAXED);
+	if (frames != NULL) retire_index_mem(index, frames, free_mem);
+	__atomic_store_n(&track->flags, track->flags | TRACK_DELETED, __ATOMIC_RELAXED);
+}
+
+ASIndex* GetIndex(RedisModuleCtx *ctx, RedisModuleString *keystr){
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_READ);
+	int keytype = RedisModule_KeyType(key);
+	if (keytype == REDISMODULE_KEYTYPE_EMPTY){
+		RedisModule_CloseKey(key);
+		return NULL;
+	}
+	if (RedisModule_ModuleTypeGetType(key) != ASIndexType){
+		RedisModule_CloseKey(key);
+		throw -1;
+	}
+
+	ASIndex *index = (ASIndex*)RedisModule_ModuleTypeGetValue(key);
+	RedisModule_CloseKey(key);
+	return index;
+}
+
+ASIndex* CreateIndex(RedisModuleCtx *ctx, RedisModuleString *keystr, uint32_t flags = 0){
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_WRITE);
+	int keytype = RedisModule_KeyType(key);
+	if (keytype != REDISMODULE_KEYTYPE_EMPTY && RedisModule_ModuleTypeGetType(key) != ASIndexType){
+		RedisModule_CloseKey(key);
+		throw -1;
+	}
+
+	ASIndex *index = NULL;
+	if (keytype == REDISMODULE_KEYTYPE_EMPTY){
+		index = new_index(flags);
+		RedisModule_ModuleTypeSetValue(key, ASIndexType, index);
+	} else {
+		index = (ASIndex*)RedisModule_ModuleTypeGetValue(key);
+	}
+	RedisModule_CloseKey(key);
+	return index;
+}
+
+
+/* reserve n ids, id to id + n - 1, and return the first */
+int64_t reserve_ids(ASIndex *index, uint64_t n){
+	int64_t id = index->next_id;
+	index->next_id += n;
+	return id;
+}
+
+/*------------------- Lookup state ----------------------------------*/
+
+void* arena_alloc(Arena *arena, size_t size){
+	size = (size + 7) & ~(size_t)7;
+	ArenaBlock *block = arena->head;
+	if (block == NULL || block->used + size > block->size){
+		size_t block_size = (block) ? 2*block->size : ARENA_MIN_BLOCK;
+		if (block_size < size) block_size = size;
+		block = (ArenaBlock*)RedisModule_Alloc(sizeof(ArenaBlock) + block_size);
+		block->next = arena->head;
+		block->size = block_size;
+		block->used = 0;
+		arena->head = block;
+		arena->total += block_size;
+	}
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+void arena_free(Arena *arena){
+	ArenaBlock *block = arena->head;
+	while (block != NULL){
+		ArenaBlock *next = block->next;
+		RedisModule_Free(block);
+		block = next;
+	}
+	arena->head = NULL;
+	arena->total = 0;
+}
+
+/* make the whole arena available again, as one block if the last */
+/* lookup spilled over into more                                  */
+void arena_reset(Arena *arena){
+	if (arena->head == NULL) return;
+	if (arena->total > ARENA_KEEP_MAX){
+		arena_free(arena);
+	} else if (arena->head->next != NULL){
+		size_t total = arena->total;
+		arena_free(arena);
+		arena_alloc(arena, total);
+		arena->head->used = 0;
+	} else {
+		arena->head->used = 0;
+	}
+}
+
+void tracker_init(TrackerTable *tracker, Arena *arena, uint32_t capacity){
+	tracker->slots = (TrackerSlot*)arena_alloc(arena, capacity*sizeof(TrackerSlot));
+	memset(tracker->slots, 0, capacity*sizeof(TrackerSlot));
+	tracker->mask = capacity - 1;
+	tracker->size = 0;
+}
+
+/* stop tracking every track, keeping the table for the next query */
+void tracker_clear(TrackerTable *tracker){
+	if (tracker->size == 0) return;
+	memset(tracker->slots, 0, (tracker->mask + 1)*sizeof(TrackerSlot));
+	tracker->size = 0;
+}
+
+static inline uint32_t tracker_home(const TrackerTable *tracker, uint32_t key){
+	return (key*0x9e3779b1U) & tracker->mask;
+}
+
+TrackerSlot* tracker_find(TrackerTable *tracker, uint32_t ord){
+	uint32_t key = ord + 1;
+	uint32_t i = tracker_home(tracker, key);
+	while (tracker->slots[i].key != 0){
+		if (tracker->slots[i].key == key) return &tracker->slots[i];
+		i = (i + 1) & tracker->mask;
+	}
+	return NULL;
+}
+
+/* start tracking ord, which must not be tracked yet.  A half full */
+/* table moves to a larger one in the arena.                       */
+void tracker_insert(TrackerTable *tracker, Arena *arena, uint32_t ord, const TrackerId &t){
+	if (2*(tracker->size + 1) > tracker->mask + 1){
+		TrackerTable old = *tracker;
+		tracker_init(tracker, arena, 2*(old.mask + 1));
+		for (uint32_t i=0;i <= old.mask;i++){
+			if (old.slots[i].key != 0)
+				tracker_insert(tracker, arena, old.slots[i].key - 1, old.slots[i].t);
+		}
+	}
+	uint32_t key = ord + 1;
+	uint32_t i = tracker_home(tracker, key);
+	while (tracker->slots[i].key != 0) i = (i + 1) & tracker->mask;
+	tracker->slots[i].key = key;
+	tracker->slots[i].t = t;
+	tracker->size++;
+}
+
+/* stop tracking the slot's track, shifting back the entries */
+/* after it so no probe sequence is broken                   */
+void tracker_erase(TrackerTable *tracker, TrackerSlot *slot){
+	uint32_t i = slot - tracker->slots;
+	uint32_t j = i;
+	while (true){
+		j = (j + 1) & tracker->mask;
+		uint32_t key = tracker->slots[j].key;
+		if (key == 0) break;
+		uint32_t home = tracker_home(tracker, key);
+		// move j back to i unless its home lies cyclically in (i, j]
+		if (((j - home) & tracker->mask) >= ((j - i) & tracker->mask)){
+			tracker->slots[i] = tracker->slots[j];
+			i = j;
+		}
+	}
+	tracker->slots[i].key = 0;
+	tracker->size--;
+}
+
+void probe_cache_init(ProbeCache *cache, Arena *arena, uint32_t capacity){
+	cache->slots = (ProbeSlot*)arena_alloc(arena, capacity*sizeof(ProbeSlot));
+	for (uint32_t i=0;i < capacity;i++) cache->slots[i].n = -1;
+	cache->mask = capacity - 1;
+	cache->size = 0;
+}
+
+/* the slot for key: either holding its postings, or the empty slot */
+/* to store them in.  Returns NULL if the cache is full.            */
+ProbeSlot* probe_cache_slot(ProbeCache *cache, Arena *arena, uint32_t key){
+	uint32_t i = (key*0x9e3779b1U) & cache->mask;
+	while (cache->slots[i].n >= 0){
+		if (cache->slots[i].key == key) return &cache->slots[i];
+		i = (i + 1) & cache->mask;
+	}
+	if (cache->size >= PROBE_CACHE_MAX_KEYS) return NULL;
+	if (2*(cache->size + 1) > cache->mask + 1){
+		ProbeCache old = *cache;
+		probe_cache_init(cache, arena, 2*(old.mask + 1));
+		for (uint32_t j=0;j <= old.mask;j++){
+			if (old.slots[j].n >= 0){
+				ProbeSlot *slot = probe_cache_slot(cache, arena, old.slots[j].key);
+				*slot = old.slots[j];
+				cache->size++;
+			}
+		}
+		return probe_cache_slot(cache, arena, key);
+	}
+	return &cache->slots[i];
+}
+
+/* return number of set bits in parameter value */
+int bitcount(uint32_t toggle){
+	return __builtin_popcount(toggle);
+}
+
+/* next larger integer with as many set bits */
+static inline uint32_t next_combination(uint32_t x){
+	uint32_t c = x & -x;
+	uint32_t r = x + c;
+	return (((r ^ x) >> 2)/c) | r;
+}
+
+/* step c[1..k], a k-combination c[1] < ... < c[k] of 0..c[k+1]-1,  */
+/* to the next in revolving door order (Knuth's Algorithm R), where   */
+/* each combination swaps one element for another: returns them in    */
+/* out and in, or false after the last.  c[k+2] must exceed c[k+1].   */
+static bool revolving_door_next(int *c, int k, int *out, int *in){
+	if (k & 1){
+		if (c[1] + 1 < c[2]){
+			*out = c[1];
+			*in = ++c[1];
+			return true;
+		}
+	} else if (c[1] > 0){
+		*out = c[1];
+		*in = --c[1];
+		return true;
+	}
+	bool decrease = k & 1;
+	for (int j=2;j <= k;){
+		if (decrease){
+			if (c[j] >= j){
+				*out = c[j];
+				*in = j - 2;
+				c[j] = c[j-1];
+				c[j-1] = j - 2;
+				return true;
+			}
+			j++;
+		}
+		if (c[j] + 1 < c[j+1]){
+			*out = c[j-1];
+			*in = c[j] + 1;
+			c[j-1] = c[j];
+			c[j]++;
+			return true;
+		}
+		j++;
+		decrease = true;
+	}
+	return false;
+}
+
+/* put the permutations of the bits in hashvalue marked by the set  */
+/* bits in toggle in candidates, up to limit of them, and return how */
+/* many.  Candidates come best first: fewest flipped bits, so the    */
+/* nearest to hashvalue, first.  Within each number of flipped bits  */
+/* they come in revolving door order, so each candidate is the one   */
+/* before it with one toggle bit flipped back and another flipped.   */
+uint32_t get_candidates(uint32_t hashvalue, uint32_t toggle, uint32_t *candidates, uint32_t limit){
+	uint32_t masks[32];
+	int n_bits = 0;
+	while (toggle != 0){
+		uint32_t bit = 0x80000000U >> __builtin_clz(toggle);
+		masks[n_bits++] = bit;
+		toggle ^= bit;
+	}
+
+	if (limit == 0) return 0;
+	uint32_t n = 0;
+	candidates[n++] = hashvalue;
+	int c[32 + 3];
+	for (int k=1;k <= n_bits && n < limit;k++){
+		// first choice of k of the toggle bits, then one swap per step
+		uint32_t value = hashvalue;
+		for (int j=1;j <= k;j++){
+			c[j] = j - 1;
+			value ^= masks[j-1];
+		}
+		c[k+1] = n_bits;
+		c[k+2] = n_bits + 1;
+		candidates[n++] = value;
+		int out, in;
+		while (n < limit && revolving_door_next(c, k, &out, &in)){
+			value ^= masks[out] ^ masks[in];
+			candidates[n++] = value;
+		}
+	}
+	return n;
+}
+
+/*------------------- Match verification ----------------------------*/
+
+/* With VERIFY, a match the tracker proposes is checked on the bit   */
+/* error rate between the query frames of its window and the track   */
+/* frames they align with, and dropped above the lookup's max_ber.   */
+/* A looser first stage, with fewer toggle bits, then still gives    */
+/* precise answers.  The aligned track frames are expanded from      */
+/* their runs into a scratch array, so the comparison is a straight  */
+/* xor and popcount over two arrays.                                 */
+
+static uint64_t hamming_scalar(const uint32_t *a, const uint32_t *b, size_t n){
+	uint64_t bits = 0;
+	size_t i = 0;
+	for (;i + 2 <= n;i += 2){
+		uint64_t x, y;
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		bits += __builtin_popcountll(x ^ y);
+	}
+	for (;i < n;i++)
+		bits += __builtin_popcount(a[i] ^ b[i]);
+	return bits;
+}
+
+#if defined(__x86_64__)
+/* popcount by nibble lookups, 8 frames at a time */
+__attribute__((target("avx2")))
+static uint64_t hamming_avx2(const uint32_t *a, const uint32_t *b, size_t n){
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (;i + 8 <= n;i += 8){
+		__m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+									 _mm256_loadu_si256((const __m256i*)(b + i)));
+		__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(x, low)),
+										 _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + hamming_scalar(a + i, b + i, n - i);
+}
+#elif defined(__ARM_NEON)
+static uint64_t hamming_neon(const uint32_t *a, const uint32_t *b, size_t n){
+	uint64x2_t acc = vdupq_n_u64(0);
+	size_t i = 0;
+	for (;i + 4 <= n;i += 4){
+		uint8x16_t x = vreinterpretq_u8_u32(veorq_u32(vld1q_u32(a + i), vld1q_u32(b + i)));
+		acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(vcntq_u8(x))));
+	}
+	return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + hamming_scalar(a + i, b + i, n - i);
+}
+#endif
+
+/* bits that differ between a[0..n) and b[0..n), set on load to */
+/* the fastest version the cpu runs                             */
+static uint64_t (*hamming_distance)(const uint32_t *a, const uint32_t *b, size_t n) = hamming_scalar;
+
+void select_hamming_distance(){
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		hamming_distance = hamming_avx2;
+#elif defined(__ARM_NEON)
+	hamming_distance = hamming_neon;
+#endif
+}
+
+/* true if query frames [start, end) are within the lookup's bit   */
+/* error rate of the track frames at offset from them, or one frame */
+/* either side.  The window is cut to the frames of the track.      */
+static bool verify_match(const IndexView *view, uint32_t ord, size_t start, size_t end, int64_t offset,
+						 LookupState *state){
+	const Track *track = &view->tracks[ord];
+	const uint32_t *frames = __atomic_load_n(&track->frames, __ATOMIC_ACQUIRE);
+	uint32_t n_entries = __atomic_load_n(&track->n_entries, __ATOMIC_RELAXED);
+	if (frames == NULL || n_entries == 0) return false;
+	const uint32_t *hashes = frames, *positions = frames + n_entries;
+
+	int64_t length = (int64_t)positions[n_entries-1] + 1;
+	int64_t first = max((int64_t)start, 1 - offset), last = min((int64_t)end, length - 1 - offset);
+	if (first >= last) return false;
+	size_t n = last - first;
+
+	// track frames at positions [first + offset - 1, last + offset + 1)
+	if (n + 2 > state->aligned_capacity){
+		state->aligned_capacity = max(2*state->aligned_capacity, n + 2);
+		state->aligned = (uint32_t*)arena_alloc(&state->arena, state->aligned_capacity*sizeof(uint32_t));
+	}
+	int64_t x = first + offset - 1;
+	uint32_t r = upper_bound(positions, positions + n_entries, (uint32_t)x) - positions;
+	for (size_t i=0;i < n + 2;i++, x++){
+		while (r < n_entries && positions[r] <= x) r++;
+		state->aligned[i] = (r > 0) ? hashes[r-1] : 0;
+	}
+
+	uint64_t bits = UINT64_MAX;
+	for (int shift=0;shift < 3;shift++)
+		bits = min(bits, hamming_distance(state->query + first, state->aligned + shift, n));
+	return (double)bits/(32.0*n) <= state->max_ber;
+}
+
+/* feed one posting to the tracker, returns true on a match.  A track */
+/* is counted at most once per query frame, so scores are at most 1.  */
+static bool track_posting(const int current, const double threshold, const IndexView *view,
+						  uint32_t ord, int pos, LookupState *state, vector<FoundId> &results){
+	TrackerSlot *iter = tracker_find(&state->tracker, ord);
+	if (iter != NULL){
+		// already being tracked 
+		TrackerId &t = iter->t;
+		if (current <= t.last_index + LOOKUP_STEPS){
+			// tracked id still in range 
+			if (pos < t.pos) t.pos = pos;
+			if (t.last_index == current) return false;
+			t.count++;
+			t.last_index = current;
+		} 
+
+		// check if count is above threshold, and if so, add to results  
+		int window_length = t.last_index - t.start_index + 1;
+		if (window_length >= LOOKUP_BLOCK){
+			double cs = (double)t.count/(double)window_length;
+			if (cs >= threshold){
+				bool verified = state->max_ber == 0
+					|| verify_match(view, ord, t.start_index, t.last_index + 1, (int64_t)t.pos - t.start_index, state);
+				if (verified)
+					results.push_back({.id = view->tracks[ord].id, .pos = t.pos, .cs = cs});
+				tracker_erase(&state->tracker, iter);
+				return verified;
+			}
+		}
+
+		if (current > t.last_index + LOOKUP_STEPS){
+			// tracked id falls out of range, reset starting index 
+			t.start_index = current;
+			t.last_index = current;
+			t.pos = pos;
+			t.count = 1;
+		}
+
+	} else {
+		// id not being tracked, start tracking
+		tracker_insert(&state->tracker, &state->arena, ord,
+					   {.start_index = current,
+						.last_index = current,
+						.pos = pos,
+						.count = 1,
+						.heap_slot = 0,
+						.verified = false });
+	}
+	return false;
+}
+
+/*------------------- Top k lookups ---------------------------------*/
+
+/* A top k lookup scores windows as track_posting does, but keeps   */
+/* scanning past matches.  The heap holds each track's best score,   */
+/* the k best at the root last.                                      */
+
+static inline void heap_place(LookupState *state, uint32_t i, const TopKEntry &entry){
+	state->heap[i] = entry;
+	tracker_find(&state->tracker, entry.ord)->t.heap_slot = i + 1;
+}
+
+static void heap_sift_up(LookupState *state, uint32_t i){
+	TopKEntry entry = state->heap[i];
+	while (i > 0 && entry.cs < state->heap[(i-1)/2].cs){
+		heap_place(state, i, state->heap[(i-1)/2]);
+		i = (i-1)/2;
+	}
+	heap_place(state, i, entry);
+}
+
+static void heap_sift_down(LookupState *state, uint32_t i){
+	TopKEntry entry = state->heap[i];
+	while (2*i + 1 < state->heap_size){
+		uint32_t child = 2*i + 1;
+		if (child + 1 < state->heap_size && state->heap[child+1].cs < state->heap[child].cs)
+			child++;
+		if (state->heap[child].cs >= entry.cs) break;
+		heap_place(state, i, state->heap[child]);
+		i = child;
+	}
+	heap_place(state, i, entry);
+}
+
+/* offer a track's score for the top k; a tie does not displace */
+/* a track already there                                        */
+static void topk_offer(LookupState *state, TrackerId &t, const TopKEntry &entry){
+	if (t.heap_slot > 0){
+		uint32_t i = t.heap_slot - 1;
+		if (entry.cs > state->heap[i].cs){
+			state->heap[i] = entry;
+			heap_sift_down(state, i);
+		}
+	} else if (state->heap_size < state->topk){
+		state->heap[state->heap_size++] = entry;
+		heap_sift_up(state, state->heap_size - 1);
+	} else if (entry.cs > state->heap[0].cs){
+		tracker_find(&state->tracker, state->heap[0].ord)->t.heap_slot = 0;
+		state->heap[0] = entry;
+		heap_sift_down(state, 0);
+	}
+}
+
+static void track_posting_topk(const int current, const double threshold, const IndexView *view,
+							   uint32_t ord, int pos, LookupState *state){
+	TrackerSlot *iter = tracker_find(&state->tracker, ord);
+	if (iter == NULL){
+		tracker_insert(&state->tracker, &state->arena, ord,
+					   {.start_index = current,
+						.last_index = current,
+						.pos = pos,
+						.count = 1,
+						.heap_slot = 0,
+						.verified = false });
+		return;
+	}
+
+	TrackerId &t = iter->t;
+	if (current > t.last_index + LOOKUP_STEPS){
+		// tracked id falls out of range, reset starting index
+		t.start_index = current;
+		t.last_index = current;
+		t.pos = pos;
+		t.count = 1;
+		t.verified = false;
+		return;
+	}
+	if (pos < t.pos) t.pos = pos;
+	if (t.last_index == current) return;
+	t.count++;
+	t.last_index = current;
+
+	int window_length = t.last_index - t.start_index + 1;
+	if (window_length >= LOOKUP_BLOCK){
+		double cs = (double)t.count/(double)window_length;
+		if (cs >= threshold && state->max_ber > 0 && !t.verified){
+			t.verified = verify_match(view, ord, t.start_index, t.last_index + 1, (int64_t)t.pos - t.start_index, state);
+			if (!t.verified){
+				// start the window over
+				t.start_index = current;
+				t.pos = pos;
+				t.count = 1;
+				return;
+			}
+		}
+		if (cs >= threshold)
+			topk_offer(state, t, {.cs = cs, .id = view->tracks[ord].id, .pos = t.pos, .ord = ord});
+	}
+}
+
+/* true once no frame after current in a query ending at end can  */
+/* beat the k-th score.  A new window needs LOOKUP_BLOCK frames,  */
+/* and a tracked window gains at most one count per frame.        */
+static bool topk_settled(LookupState *state, int current, int end){
+	if (state->heap_size < state->topk) return false;
+	double kth = state->heap[0].cs;
+	if (kth >= 1.0) return true;
+	int remaining = end - 1 - current;
+	if (remaining >= LOOKUP_BLOCK) return false;
+
+	TrackerTable *tracker = &state->tracker;
+	for (uint32_t i=0;i <= tracker->mask;i++){
+		if (tracker->slots[i].key == 0) continue;
+		const TrackerId &t = tracker->slots[i].t;
+		int length = end - t.start_index;
+		if (length >= LOOKUP_BLOCK && (double)(t.count + remaining)/(double)length > kth)
+			return false;
+	}
+	return true;
+}
+
+/* the heap's tracks, best first, ties by ordinal */
+static void topk_results(LookupState *state, vector<FoundId> &results){
+	sort(state->heap, state->heap + state->heap_size, [](const TopKEntry &a, const TopKEntry &b){
+			return (a.cs != b.cs) ? a.cs > b.cs : a.ord < b.ord;
+		});
+	for (uint32_t i=0;i < state->heap_size;i++)
+		results.push_back({.id = state->heap[i].id, .pos = state->heap[i].pos, .cs = state->heap[i].cs});
+}
+
+/* copy (ord, pos) pairs to postings until n reaches the per frame */
+/* budget, skipping deleted tracks still held by read segments, and */
+/* tracks added after the view was published                        */
+static void scan_postings(const IndexView *view, PostingCursor *cursor, uint32_t *postings, int *n){
+	uint32_t ord, pos;
+	while (*n < LOOKUP_ENTRIES_PER_FRAME_LIMIT && posting_next(cursor, &ord, &pos)){
+		if (ord >= view->n_tracks) continue;
+		if (__atomic_load_n(&view->tracks[ord].flags, __ATOMIC_RELAXED) & TRACK_DELETED) continue;
+		postings[2*(*n)] = ord;
+		postings[2*(*n) + 1] = pos;
+		(*n)++;
+	}
+}
+
+/* gather the postings of hashframe a lookup considers, at most   */
+/* LOOKUP_ENTRIES_PER_FRAME_LIMIT, returns how many, or -1 for a  */
+/* stop frame: one dropped by a merge, or with more than          */
+/* stop_postings postings, those of deleted tracks too.  They are */
+/* counted in the same pass over the segments that scans them.    */
+int probe_hashframe(const IndexView *view, uint32_t hashframe, uint32_t *postings){
+
+	// scan the most recently added postings first: the delta, the
+	// delta being merged, then the segments newest to oldest
+	bool compressed = view->flags & AS_INDEX_COMPRESSED;
+	bool stops = stop_postings > 0;
+	int n = 0;
+	uint64_t count = 0;
+	PostingCursor cursor;
+	PostingList *pl = frame_table_get(view->delta, hashframe);
+	if (pl != NULL){
+		posting_cursor_init(&cursor, pl, compressed);
+		count += cursor.remaining;
+		scan_postings(view, &cursor, postings, &n);
+	}
+
+	PostingList *frozen_pl = (view->frozen != NULL) ? frame_table_get(view->frozen, hashframe) : NULL;
+	if (frozen_pl != NULL){
+		posting_cursor_init(&cursor, frozen_pl, compressed);
+		count += cursor.remaining;
+		scan_postings(view, &cursor, postings, &n);
+	}
+
+	// with stop frames, every segment is looked at for the count
+	for (uint32_t i=view->n_segments;i > 0 && (stops || n < LOOKUP_ENTRIES_PER_FRAME_LIMIT);i--){
+		const Segment *seg = view->segments[i-1];
+		if (segment_find(seg, hashframe, compressed, &cursor)){
+			count += cursor.remaining;
+			scan_postings(view, &cursor, postings, &n);
+		} else if (stops && segment_stopped(seg, hashframe)){
+			return -1;
+		}
+	}
+	return (stops && count > stop_postings) ? -1 : n;
+}
+
+/* Group prefetching.  Each probe is a chain of dependent cache      */
+/* misses: table slot, then posting list, or filter block, then      */
+/* directory and keys.  Before a batch of candidates is probed, the   */
+/* slots and filter blocks of all of them are prefetched, then the    */
+/* posting lists those slots point to, so the misses overlap.  A     */
+/* build with PROBE_BATCH 1 probes each candidate on its own.         */
+static void prefetch_probes(const IndexView *view, const uint32_t *hashframes, uint32_t n){
+	const FrameTable *tables[2] = { view->delta, view->frozen };
+	for (uint32_t i=0;i < n;i++){
+		for (const FrameTable *table : tables){
+			if (table != NULL)
+				__builtin_prefetch(&table->slots[frame_hash(hashframes[i]) & table->mask]);
+		}
+		for (uint32_t j=0;j < view->n_segments;j++){
+			uint32_t x;
+			__builtin_prefetch(filter_block(view->segments[j], hashframes[i], &x));
+		}
+	}
+	for (uint32_t i=0;i < n;i++){
+		for (const FrameTable *table : tables){
+			if (table == NULL) continue;
+			const FrameSlot *slot = &table->slots[frame_hash(hashframes[i]) & table->mask];
+			PostingList *pl = __atomic_load_n(&slot->postings, __ATOMIC_ACQUIRE);
+			if (pl != NULL && slot->key == hashframes[i])
+				__builtin_prefetch(pl);
+		}
+	}
+}
+
+/* the postings of hashframe as (ord, pos) pairs, in buffer or   */
+/* in the probe cache.  With a probe cache, each hashframe is     */
+/* only probed once per batch.                                    */
+static int get_postings(const IndexView *view, uint32_t hashframe, LookupState *state,
+						uint32_t *buffer, uint32_t **postings){
+	*postings = buffer;
+	ProbeSlot *slot = (state->cache.slots) ? probe_cache_slot(&state->cache, &state->arena, hashframe) : NULL;
+	if (slot != NULL && slot->n >= 0){
+		*postings = slot->postings;
+		return slot->n;
+	}
+
+	int n = probe_hashframe(view, hashframe, buffer);
+	if (n < 0){
+		state->stop_probes++;
+		n = 0;
+	}
+	if (slot != NULL){
+		slot->key = hashframe;
+		slot->n = n;
+		slot->postings = (uint32_t*)arena_alloc(&state->arena, 2*n*sizeof(uint32_t));
+		memcpy(slot->postings, buffer, 2*n*sizeof(uint32_t));
+		state->cache.size++;
+	}
+	return n;
+}
+
+/* feed the postings of hashframe to the tracker, returns true on */
+/* a match                                                         */
+bool lookup_hashframe(RedisModuleCtx *ctx, const int current,
+					  const double threshold,  const IndexView *view,
+					  uint32_t hashframe, LookupState *state, vector<FoundId> &results){
+	uint32_t buffer[2*LOOKUP_ENTRIES_PER_FRAME_LIMIT];
+	uint32_t *postings;
+	int n = get_postings(view, hashframe, state, buffer, &postings);
+
+	if (state->topk > 0){
+		for (int i=0;i < n;i++)
+			track_posting_topk(current, threshold, view, postings[2*i], (int)postings[2*i+1], state);
+		return false;
+	}
+	for (int i=0;i < n;i++){
+		if (track_posting(current, threshold, view, postings[2*i], (int)postings[2*i+1], state, results))
+			return true;
+	}
+	return false;
+}
+
+/* put the indexed hash values within radius bits of hashvalue in   */
+/* candidates, grown in the arena as needed, and return how many.   */
+/* A value is only taken from the first table whose substring is    */
+/* close enough, so none is listed twice.                           */
+uint32_t get_radius_candidates(const IndexView *view, uint32_t hashvalue, int radius, Arena *arena,
+							   uint32_t **candidates, uint32_t *capacity){
+	uint32_t m = AS_INDEX_MIH_TABLES(view->flags);
+	int sub_radius = radius/m;
+	uint32_t masks[MIH_MAX_TABLES];
+	for (uint32_t j=0;j < m;j++){
+		uint32_t shift, bits;
+		mih_substring(m, j, &shift, &bits);
+		masks[j] = ((1U << bits) - 1) << shift;
+	}
+
+	uint32_t n = 0;
+	for (uint32_t j=0;j < m;j++){
+		uint32_t shift, bits;
+		mih_substring(m, j, &shift, &bits);
+		uint32_t substring = (hashvalue & masks[j]) >> shift;
+		for (int k=0;k <= sub_radius && k <= (int)bits;k++){
+			// each flip of k substring bits
+			for (uint32_t flip = (1U << k) - 1;flip < (1U << bits);flip = (k) ? next_combination(flip) : (1U << bits)){
+				PostingList *pl = frame_table_get(view->mih[j], substring ^ flip);
+				if (pl == NULL) continue;
+				uint32_t length = __atomic_load_n(&pl->length, __ATOMIC_ACQUIRE);
+				for (uint32_t i=0;i < length;i++){
+					uint32_t diff = pl->data[i] ^ hashvalue;
+					if (__builtin_popcount(diff) > radius) continue;
+					uint32_t first = 0;
+					while (__builtin_popcount(diff & masks[first]) > sub_radius) first++;
+					if (first != j) continue;
+					if (n == *capacity){
+						*capacity = (*capacity) ? 2*(*capacity) : 64;
+						uint32_t *grown = (uint32_t*)arena_alloc(arena, (*capacity)*sizeof(uint32_t));
+						if (n > 0) memcpy(grown, *candidates, n*sizeof(uint32_t));
+						*candidates = grown;
+					}
+					(*candidates)[n++] = pl->data[i];
+				}
+			}
+		}
+	}
+
+	// nearest first, as for toggle candidates
+	sort(*candidates, *candidates + n, [hashvalue](uint32_t a, uint32_t b){
+			int da = __builtin_popcount(a ^ hashvalue), db = __builtin_popcount(b ^ hashvalue);
+			return (da != db) ? da < db : a < b;
+		});
+	return n;
+}
+
+/* the hash values to probe for a query frame, best first: the     */
+/* toggle permutations of the frame, or the indexed values within   */
+/* the lookup's radius of it.  Under a probe limit the frame gets an */
+/* even share of the probes left to the frames_left frames, and past */
+/* the deadline only its best candidate, but always at least one.   */
+/* Returns how many.                                                */
+static uint32_t frame_candidates(const IndexView *view, uint32_t frame, uint32_t toggle, size_t frames_left,
+								 LookupState *state, uint32_t **candidates, uint32_t *capacity){
+	uint32_t limit = UINT32_MAX;
+	if (state->probes_left != UINT64_MAX){
+		uint64_t share = state->probes_left/frames_left;
+		limit = (share > 1) ? (uint32_t)min(share, (uint64_t)UINT32_MAX) : 1;
+	}
+	if (limit > 1 && state->deadline != chrono::time_point<chrono::high_resolution_clock>::max()
+		&& chrono::high_resolution_clock::now() >= state->deadline)
+		limit = 1;
+
+	uint32_t n;
+	if (state->radius >= 0){
+		n = get_radius_candidates(view, frame, state->radius, &state->arena, candidates, capacity);
+		if (n > limit){
+			n = limit;
+			state->truncated = true;
+		}
+	} else {
+		uint32_t n_toggled = 0x01U << bitcount(toggle);
+		n = min(n_toggled, limit);
+		if (n < n_toggled) state->truncated = true;
+		if (n > *capacity){
+			*candidates = (uint32_t*)arena_alloc(&state->arena, n*sizeof(uint32_t));
+			*capacity = n;
+		}
+		get_candidates(frame, toggle, *candidates, n);
+	}
+	if (state->probes_left != UINT64_MAX)
+		state->probes_left -= min((uint64_t)n, state->probes_left);
+	return n;
+}
+
+/* ready state to run one query, or one range of a query, with at */
+/* most max_probes probes (0 for no limit), expanding candidates  */
+/* until deadline                                                  */
+void budget_begin(LookupState *state, uint64_t max_probes, chrono::time_point<chrono::high_resolution_clock> deadline){
+	state->probes_left = (max_probes) ? max_probes : UINT64_MAX;
+	state->deadline = deadline;
+	state->truncated = false;
+}
+
+/* ready state for the queries of a new lookup command, sharing */
+/* probes between them when shared is set, and keeping the best */
+/* topk matches of each unless it is 0.  A radius of -1 probes  */
+/* the toggle permutations of each frame.  Matches are verified */
+/* to a bit error rate of max_ber, unless it is 0.  The tracker, */
+/* heap and scratch buffers are kept from one query to the next, */
+/* so only the probe cache grows with the number of queries.    */
+void lookup_begin(LookupState *state, bool shared, uint32_t topk, int radius, double max_ber){
+	arena_reset(&state->arena);
+	state->stop_probes = 0;
+	state->topk = topk;
+	state->radius = radius;
+	state->max_ber = max_ber;
+	state->aligned = NULL;
+	state->aligned_capacity = 0;
+	state->candidates = NULL;
+	state->candidates_capacity = 0;
+	tracker_init(&state->tracker, &state->arena, TRACKER_MIN_CAPACITY);
+	if (topk > 0)
+		state->heap = (TopKEntry*)arena_alloc(&state->arena, topk*sizeof(TopKEntry));
+	if (shared)
+		probe_cache_init(&state->cache, &state->arena, PROBE_CACHE_MIN_CAPACITY);
+	else
+		state->cache.slots = NULL;
+}
+
+/* add the stop frame probes state skipped to the index's count */
+void flush_stop_probes(ASIndex *index, LookupState *state){
+	if (state->stop_probes == 0) return;
+	__atomic_add_fetch(&index->stop_probes, state->stop_probes, __ATOMIC_RELAXED);
+	state->stop_probes = 0;
+}
+
+/* score query frames [start, end) against the index, stopping at */
+/* the first frame with a match.  Returns that frame, or SIZE_MAX. */
+/* A top k lookup instead scans on until the top k are settled.    */
+/* Worker threads pass their reader slot, and read the published   */
+/* view of the index from within an epoch, one query frame at a    */
+/* time; the main thread passes -1.  state must be readied by      */
+/* lookup_begin and budget_begin.  Ranges of a split query share   */
+/* best, the earliest match frame so far, and give up on frames    */
+/* past it.                                                        */
+size_t run_lookup(ASIndex *index, const vector<uint32_t> &frames, const vector<uint32_t> &toggles,
+				  size_t start, size_t end, const double threshold, int slot, LookupState *state,
+				  vector<FoundId> &results, size_t *best){
+	tracker_clear(&state->tracker);
+	state->query = frames.data();
+	state->heap_size = 0;
+	for (size_t i=start;i < end;i++){
+		if (best != NULL && i > __atomic_load_n(best, __ATOMIC_RELAXED))
+			break;
+		if (slot >= 0){
+			if (__atomic_load_n(&index->dropped, __ATOMIC_ACQUIRE)) // key deleted meanwhile
+				break;
+			epoch_enter(slot);
+		}
+		const IndexView *view = __atomic_load_n(&index->view, __ATOMIC_SEQ_CST);
+		uint32_t n_candidates = frame_candidates(view, frames[i], toggles[i], end - i, state,
+												 &state->candidates, &state->candidates_capacity);
+		const uint32_t *candidates = state->candidates;
+		for (uint32_t j=0;j < n_candidates;j++){
+			if (j % PROBE_BATCH == 0)
+				prefetch_probes(view, candidates + j, min(n_candidates - j, (uint32_t)PROBE_BATCH));
+			lookup_hashframe(NULL, i, threshold, view, candidates[j], state, results);
+		}
+		if (slot >= 0) epoch_exit(slot);
+
+		if (state->topk > 0){
+			if (topk_settled(state, i, end)) break;
+		} else if (results.size() > 0){
+			if (best != NULL){
+				size_t prev = __atomic_load_n(best, __ATOMIC_RELAXED);
+				while (i < prev && !__atomic_compare_exchange_n(best, &prev, i, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			}
+			return i;
+		}
+	}
+	if (state->topk > 0) topk_results(state, results);
+	return SIZE_MAX;
+}
+
+/*------------------- Offset voting ---------------------------------*/
+
+/* The offset scorer votes each posting (ord, pos) hit by query frame */
+/* i into the bin (ord, pos - i).  A track the query was cut from     */
+/* piles its votes into one bin, whatever the order or spacing of the */
+/* hits.  A vote is just its bin's key, (ord + 1) << 32 | biased      */
+/* offset, appended to a flat batch; a full batch is radix sorted and */
+/* merged into the sorted bins, counting runs of equal keys in one    */
+/* pass, so no vote pays for a hash table probe.                      */
+
+#define OFFSET_BIAS 0x80000000U
+
+/* sort keys a byte at a time, least significant first, skipping */
+/* the bytes all keys share - most of them, as a query's votes    */
+/* span few tracks and offsets                                    */
+static void radix_sort(vector<uint64_t> &keys, vector<uint64_t> &scratch){
+	size_t n = keys.size();
+	if (n < 2) return;
+	size_t counts[8][256] = {};
+	for (size_t i=0;i < n;i++){
+		uint64_t key = keys[i];
+		for (int b=0;b < 8;b++)
+			counts[b][(key >> 8*b) & 0xff]++;
+	}
+
+	scratch.resize(n);
+	uint64_t *src = keys.data(), *dst = scratch.data();
+	for (int b=0;b < 8;b++){
+		if (counts[b][(src[0] >> 8*b) & 0xff] == n) continue;
+		size_t offset = 0;
+		for (int d=0;d < 256;d++){
+			size_t count = counts[b][d];
+			counts[b][d] = offset;
+			offset += count;
+		}
+		for (size_t i=0;i < n;i++)
+			dst[counts[b][(src[i] >> 8*b) & 0xff]++] = src[i];
+		swap(src, dst);
+	}
+	if (src != keys.data()) keys.swap(scratch);
+}
+
+/* count the batch of votes into the bins */
+static void fold_votes(VoteBins *votes){
+	vector<uint64_t> &batch = votes->batch;
+	if (batch.empty()) return;
+	radix_sort(batch, votes->scratch);
+
+	vector<uint64_t> &keys = votes->scratch;
+	vector<uint32_t> &counts = votes->scratch_counts;
+	keys.clear();
+	counts.clear();
+	size_t i = 0, j = 0;
+	while (i < batch.size() || j < votes->keys.size()){
+		uint64_t key = (j == votes->keys.size() || (i < batch.size() && batch[i] < votes->keys[j]))
+			? batch[i] : votes->keys[j];
+		uint32_t count = 0;
+		if (j < votes->keys.size() && votes->keys[j] == key) count += votes->counts[j++];
+		for (;i < batch.size() && batch[i] == key;i++) count++;
+		keys.push_back(key);
+		counts.push_back(count);
+	}
+	votes->keys.swap(keys);
+	votes->counts.swap(counts);
+	batch.clear();
+}
+
+/* score query frames by offset votes.  A track's score is the vote */
+/* share of its strongest bin among the query frames; the best, or  */
+/* the best topk, at or above threshold are kept.                   */
+void run_offset_lookup(ASIndex *index, const vector<uint32_t> &frames, const vector<uint32_t> &toggles,
+					   const double threshold, int slot, LookupState *state, vector<FoundId> &results){
+	VoteBins votes;
+	uint32_t buffer[2*LOOKUP_ENTRIES_PER_FRAME_LIMIT];
+	size_t n_frames = frames.size();
+	for (size_t i=0;i < n_frames;i++){
+		if (slot >= 0){
+			if (__atomic_load_n(&index->dropped, __ATOMIC_ACQUIRE)) // key deleted meanwhile
+				return;
+			epoch_enter(slot);
+		}
+		const IndexView *view = __atomic_load_n(&index->view, __ATOMIC_SEQ_CST);
+		uint32_t n_candidates = frame_candidates(view, frames[i], toggles[i], n_frames - i, state,
+												 &state->candidates, &state->candidates_capacity);
+		const uint32_t *candidates = state->candidates;
+		for (uint32_t j=0;j < n_candidates;j++){
+			if (j % PROBE_BATCH == 0)
+				prefetch_probes(view, candidates + j, min(n_candidates - j, (uint32_t)PROBE_BATCH));
+			uint32_t *postings;
+			int n = get_postings(view, candidates[j], state, buffer, &postings);
+			for (int k=0;k < n;k++){
+				uint64_t key = ((uint64_t)(postings[2*k] + 1) << 32) | (uint32_t)(postings[2*k+1] - (uint32_t)i + OFFSET_BIAS);
+				votes.batch.push_back(key);
+			}
+		}
+		if (slot >= 0) epoch_exit(slot);
+		if (votes.batch.size() >= VOTE_BATCH_KEYS) fold_votes(&votes);
+	}
+	fold_votes(&votes);
+
+	// bins with enough votes, strongest first
+	uint32_t min_votes = (uint32_t)ceil(threshold*n_frames);
+	if (min_votes == 0) min_votes = 1;
+	vector<uint32_t> bins;
+	for (uint32_t i=0;i < votes.keys.size();i++){
+		if (votes.counts[i] >= min_votes) bins.push_back(i);
+	}
+	sort(bins.begin(), bins.end(), [&votes](uint32_t a, uint32_t b){
+			return (votes.counts[a] != votes.counts[b]) ? votes.counts[a] > votes.counts[b] : votes.keys[a] < votes.keys[b];
+		});
+
+	// one result per track, from its strongest bin that verifies
+	if (slot >= 0) epoch_enter(slot);
+	const IndexView *view = __atomic_load_n(&index->view, __ATOMIC_SEQ_CST);
+	state->query = frames.data();
+	uint32_t limit = (state->topk > 0) ? state->topk : 1;
+	vector<uint32_t> ords;
+	for (uint32_t i : bins){
+		if (ords.size() == limit) break;
+		uint32_t ord = (uint32_t)(votes.keys[i] >> 32) - 1;
+		if (find(ords.begin(), ords.end(), ord) != ords.end()) continue;
+		int64_t offset = (int64_t)(uint32_t)votes.keys[i] - OFFSET_BIAS;
+		if (state->max_ber > 0 && !verify_match(view, ord, 0, n_frames, offset, state)) continue;
+		ords.push_back(ord);
+		// a frame may vote twice into a bin, through toggles or a repeated frame
+		results.push_back({.id = view->tracks[ord].id, .pos = (offset > 0) ? offset : 0,
+					.cs = min(1.0, (double)votes.counts[i]/(double)n_frames)});
+	}
+	if (slot >= 0) epoch_exit(slot);
+}
+
+/*------------------- Stream sessions -------------------------------*/
+
+/* A stream session scores a stream pushed a few frames at a time.  */
+/* Frames are numbered from the start of the stream, so a track's    */
+/* window carries over from one push into the next.                 */
+
+static long long next_session_id = 1;
+
+StreamSession* find_session(ASIndex *index, long long id){
+	for (StreamSession *session = index->sessions;session != NULL;session = session->next){
+		if (session->id == id) return session;
+	}
+	return NULL;
+}
+
+void free_session(StreamSession *session){
+	arena_free(&session->state.arena);
+	RedisModule_Free(session);
+}
+
+void unlink_session(ASIndex *index, StreamSession *session){
+	StreamSession **link = &index->sessions;
+	while (*link != session) link = &(*link)->next;
+	*link = session->next;
+}
+
+/* a push of the session is done, free the session if it was */
+/* closed meanwhile                                           */
+void release_session(StreamSession *session){
+	session->busy = false;
+	session->last_used = RedisModule_Milliseconds();
+	if (session->closed) free_session(session);
+}
+
+/* free the sessions left idle for longer than their ttl */
+void expire_sessions(ASIndex *index, long long now){
+	StreamSession **link = &index->sessions;
+	while (*link != NULL){
+		StreamSession *session = *link;
+		if (!session->busy && now - session->last_used >= session->ttl){
+			*link = session->next;
+			free_session(session);
+		} else {
+			link = &session->next;
+		}
+	}
+}
+
+/* drop the tracks that fell out of range - their next hit starts  */
+/* them over anyway - and move the rest to a fresh arena, so a long */
+/* stream does not keep every track it ever hit.  Frames are        */
+/* renumbered before they can overflow.                             */
+static void compact_session(StreamSession *session){
+	LookupState *state = &session->state;
+	int current = (int)session->frames_seen;
+	vector<TrackerSlot> live;
+	for (uint32_t i=0;i <= state->tracker.mask;i++){
+		const TrackerSlot &slot = state->tracker.slots[i];
+		if (slot.key != 0 && slot.t.last_index + LOOKUP_STEPS >= current)
+			live.push_back(slot);
+	}
+
+	int shift = (session->frames_seen >= STREAM_FRAMES_REBASE) ? current : 0;
+	session->frames_seen -= shift;
+	arena_reset(&state->arena);
+	state->candidates = NULL;
+	state->candidates_capacity = 0;
+	tracker_init(&state->tracker, &state->arena, TRACKER_MIN_CAPACITY);
+	for (TrackerSlot &slot : live){
+		slot.t.start_index -= shift;
+		slot.t.last_index -= shift;
+		tracker_insert(&state->tracker, &state->arena, slot.key - 1, slot.t);
+	}
+}
+
+/* feed the frames of a push to the session's tracker, adding each */
+/* match to results as its track crosses the threshold.  Worker     */
+/* threads pass their reader slot, the main thread -1.              */
+void run_stream_push(ASIndex *index, StreamSession *session, const vector<uint32_t> &frames,
+					 const vector<uint32_t> &toggles, int slot, vector<FoundId> &results){
+	LookupState *state = &session->state;
+	budget_begin(state, 0, chrono::time_point<chrono::high_resolution_clock>::max());
+	uint32_t buffer[2*LOOKUP_ENTRIES_PER_FRAME_LIMIT];
+	size_t n_frames = frames.size();
+	for (size_t i=0;i < n_frames;i++){
+		if (slot >= 0){
+			if (__atomic_load_n(&index->dropped, __ATOMIC_ACQUIRE)) // key deleted meanwhile
+				return;
+			epoch_enter(slot);
+		}
+		const IndexView *view = __atomic_load_n(&index->view, __ATOMIC_SEQ_CST);
+		int current = (int)(session->frames_seen + i);
+		uint32_t n_candidates = frame_candidates(view, frames[i], toggles[i], n_frames - i, state,
+												 &state->candidates, &state->candidates_capacity);
+		const uint32_t *candidates = state->candidates;
+		for (uint32_t j=0;j < n_candidates;j++){
+			if (j % PROBE_BATCH == 0)
+				prefetch_probes(view, candidates + j, min(n_candidates - j, (uint32_t)PROBE_BATCH));
+			uint32_t *postings;
+			int n = get_postings(view, candidates[j], state, buffer, &postings);
+			for (int k=0;k < n;k++)
+				track_posting(current, session->threshold, view, postings[2*k], (int)postings[2*k+1], state, results);
+		}
+		if (slot >= 0) epoch_exit(slot);
+	}
+	session->frames_seen += n_frames;
+	compact_session(session);
+}
+
+/*------------------- Lookup workers --------------------------------*/
+
+typedef struct lookup_query_t {
+	vector<uint32_t> frames, toggles;
+	vector<FoundId> results;
+	bool truncated = false;     // the probe budget cut the query short
+} LookupQuery;
+
+/* the queries of a lookup command, run inline or handed to the */
+/* worker pool                                                  */
+typedef struct lookup_job_t {
+	ASIndex *index;
+	vector<LookupQuery> queries;
+	double threshold;
+	bool batch;                 // mlookup, one reply per query
+	uint32_t topk;              // 0 for the first match
+	int scorer;                 // LOOKUP_SCORER_*
+	int radius;                 // hamming radius, -1 to probe toggles
+	uint64_t max_probes;        // probes per query, 0 for no limit
+	long long budget_usec;      // run time per query, 0 for no limit
+	double max_ber = 0;         // VERIFY bit error rate, 0 to not verify
+	StreamSession *session = NULL;  // set for a stream push
+	bool cache = false;         // results go to the index's result cache
+	uint64_t digest, generation;
+	RedisModuleBlockedClient *bc;
+	chrono::time_point<chrono::high_resolution_clock> start;
+} LookupJob;
+
+/* a range of a long query's frames, scored on its own tracker by */
+/* whichever worker is free.  Ranges overlap by LOOKUP_BLOCK +     */
+/* LOOKUP_STEPS frames so a match window is seen whole by one.    */
+typedef struct lookup_range_t {
+	ASIndex *index;
+	const LookupQuery *query;
+	double threshold;
+	uint32_t topk;
+	int radius;
+	double max_ber;
+	size_t start, end;
+	uint64_t max_probes;        // the range's share of the query's
+	chrono::time_point<chrono::high_resolution_clock> deadline;
+	bool truncated;
+	size_t stop;                // frame of the match, SIZE_MAX if none
+	vector<FoundId> results;
+	size_t *best;
+	int *pending;               // ranges of the query still running
+} LookupRange;
+
+/* a track of a mapped fingerprint file, see map_fingerprint_file */
+typedef struct import_track_t {
+	int64_t id;                 // 0 to assign the next id
+	const uint32_t *data;       // network order frames
+	uint32_t n_frames;
+	const char *descr;
+	uint32_t descr_len;
+} ImportTrack;
+
+/* tracks added by one command and indexed on a lookup worker.  The  */
+/* main thread reserves their ids and ordinals, first_ord on, and    */
+/* codes the frames of an add; the worker codes those of an import   */
+/* and builds read segments of the postings, shared by the adds it   */
+/* takes together.  The main thread then installs tracks and         */
+/* segments in one step, see install_batch.                          */
+typedef struct add_job_t {
+	ASIndex *index;
+	uint32_t n_tracks, first_ord;
+	int64_t *ids;
+	int64_t first_id;           // ids the job reserved, given back
+	uint32_t n_ids;             // if it is never installed
+	uint32_t **frames;          // run length coded, as in Track
+	uint32_t *n_entries;
+	ImportTrack *source;        // tracks of an import, coded by the worker
+	void *map;                  // the mapped file of an import
+	size_t map_len;
+	bool descr;                 // auscout.addtrack, argv[3] is the descr
+	struct add_batch_t *batch;  // set by the worker
+	bool installed, replied;
+	RedisModuleBlockedClient *bc;
+} AddJob;
+
+/* add jobs a worker took together and the read segments of all their */
+/* tracks.  The first of them to reply installs the tracks of every   */
+/* job still waiting, so a segment never holds postings of a track    */
+/* that is not yet visible.  The last job freed frees the batch.      */
+typedef struct add_batch_t {
+	vector<AddJob*> jobs;       // NULL once freed
+	Segment **segments;
+	uint32_t n_segments;
+	uint32_t refs;              // jobs not yet freed
+	bool installed;
+	uint64_t dead_entries;      // of jobs freed before the install
+} AddBatch;
+
+typedef struct lookup_worker_t {
+	int slot;
+	LookupState state;          // for the worker's own jobs
+	LookupState range_state;    // for ranges of any job
+} LookupWorker;
+
+static pthread_mutex_t lookup_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lookup_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lookup_range_cond = PTHREAD_COND_INITIALIZER;
+static deque<LookupJob*> lookup_queue;
+static deque<LookupRange*> range_queue;  // served before lookup_queue
+static deque<AddJob*> add_queue;         // served after lookup_queue
+static int n_lookup_workers = 0;
+static long long split_frames = 0;       // queries this long are split, 0 never
+static long long async_add_frames = ASYNC_ADD_FRAMES_DEFAULT; // 0 never
+static LookupState inline_lookup_state;  // lookups run on the main thread
+
+/* postings of an add job's tracks, those of an import only once */
+/* the worker has coded them                                       */
+static uint64_t add_job_entries(const AddJob *job){
+	uint64_t n = 0;
+	for (uint32_t i=0;i < job->n_tracks;i++)
+		n += job->n_entries[i];
+	return n;
+}
+
+/* code the frames of an import, and build segments of the tracks */
+/* of a batch of jobs of about IMPORT_SEGMENT_POSTINGS postings    */
+/* each                                                            */
+static void run_add_batch(const vector<AddJob*> &jobs){
+	vector<uint32_t*> frames;
+	vector<uint32_t> n_entries, ords;
+	for (AddJob *job : jobs){
+		for (uint32_t i=0;i < job->n_tracks;i++){
+			if (job->source != NULL){
+				const ImportTrack &src = job->source[i];
+				job->n_entries[i] = count_entries(src.data, src.n_frames);
+				if (job->n_entries[i] > 0){
+					job->frames[i] = (uint32_t*)RedisModule_Alloc(2*job->n_entries[i]*sizeof(uint32_t));
+					code_frames(src.data, src.n_frames, job->frames[i], job->frames[i] + job->n_entries[i]);
+				}
+			}
+			frames.push_back(job->frames[i]);
+			n_entries.push_back(job->n_entries[i]);
+			ords.push_back(job->first_ord + i);
+		}
+	}
+
+	AddBatch *batch = new AddBatch;
+	batch->jobs = jobs;
+	batch->refs = jobs.size();
+	batch->installed = false;
+	batch->dead_entries = 0;
+	batch->n_segments = 0;
+	bool compressed = jobs[0]->index->flags & AS_INDEX_COMPRESSED;
+	uint32_t n_tracks = frames.size();
+	batch->segments = (Segment**)RedisModule_Alloc((n_tracks + 1)*sizeof(Segment*));
+	uint32_t first = 0;
+	uint64_t acc = 0;
+	for (uint32_t i=0;i <= n_tracks;i++){
+		if (i == n_tracks || (acc > 0 && acc + n_entries[i] > IMPORT_SEGMENT_POSTINGS)){
+			if (acc > 0)
+				batch->segments[batch->n_segments++] = build_tracks_segment(ords.data() + first, frames.data() + first,
+																			n_entries.data() + first, i - first,
+																			compressed);
+			first = i;
+			acc = 0;
+		}
+		if (i < n_tracks) acc += n_entries[i];
+	}
+	for (AddJob *job : jobs)
+		job->batch = batch;
+}
+
+static void run_range(LookupWorker *worker, LookupRange *range){
+	lookup_begin(&worker->range_state, false, range->topk, range->radius, range->max_ber);
+	budget_begin(&worker->range_state, range->max_probes, range->deadline);
+	range->stop = run_lookup(range->index, range->query->frames, range->query->toggles, range->start, range->end,
+							 range->threshold, worker->slot, &worker->range_state, range->results, range->best);
+	range->truncated = worker->range_state.truncated;
+	flush_stop_probes(range->index, &worker->range_state);
+	pthread_mutex_lock(&lookup_queue_mutex);
+	if (--(*range->pending) == 0)
+		pthread_cond_broadcast(&lookup_range_cond);
+	pthread_mutex_unlock(&lookup_queue_mutex);
+}
+
+/* merge the top k of each range, keeping a track's best score */
+static void merge_topk(vector<LookupRange> &ranges, uint32_t topk, vector<FoundId> &results){
+	unordered_map<int64_t, FoundId> best;
+	for (LookupRange &range : ranges){
+		for (FoundId &fnd : range.results){
+			auto iter = best.find(fnd.id);
+			if (iter == best.end() || fnd.cs > iter->second.cs)
+				best[fnd.id] = fnd;
+		}
+	}
+	for (auto &kv : best) results.push_back(kv.second);
+	sort(results.begin(), results.end(), [](const FoundId &a, const FoundId &b){
+			return (a.cs != b.cs) ? a.cs > b.cs : a.id < b.id;
+		});
+	if (results.size() > topk) results.resize(topk);
+}
+
+/* score a long query in ranges spread over the worker pool, and  */
+/* keep the results of the range that matched at the earliest     */
+/* frame, the first such range on a tie; or, for a top k lookup,  */
+/* the best k over all ranges                                      */
+static void run_split_lookup(LookupWorker *worker, LookupJob *job, LookupQuery &query,
+							 chrono::time_point<chrono::high_resolution_clock> deadline){
+	uint32_t topk = job->topk;
+	size_t n_frames = query.frames.size();
+	size_t n_ranges = min((size_t)n_lookup_workers, n_frames/(size_t)split_frames);
+	size_t overlap = LOOKUP_BLOCK + LOOKUP_STEPS;
+	size_t best = SIZE_MAX;
+	int pending = n_ranges;
+	vector<LookupRange> ranges(n_ranges);
+	for (size_t r=0;r < n_ranges;r++){
+		LookupRange &range = ranges[r];
+		range.index = job->index;
+		range.query = &query;
+		range.threshold = job->threshold;
+		range.topk = topk;
+		range.radius = job->radius;
+		range.max_ber = job->max_ber;
+		range.start = r*n_frames/n_ranges;
+		range.start = (range.start > overlap) ? range.start - overlap : 0;
+		range.end = (r + 1)*n_frames/n_ranges;
+		range.max_probes = (job->max_probes) ? max((uint64_t)1, job->max_probes*(range.end - range.start)/n_frames) : 0;
+		range.deadline = deadline;
+		range.best = (topk) ? NULL : &best;
+		range.pending = &pending;
+	}
+
+	pthread_mutex_lock(&lookup_queue_mutex);
+	for (size_t r=1;r < n_ranges;r++)
+		range_queue.push_back(&ranges[r]);
+	pthread_cond_broadcast(&lookup_queue_cond);
+	pthread_mutex_unlock(&lookup_queue_mutex);
+
+	// score the first range here, then help out until all are done
+	run_range(worker, &ranges[0]);
+	pthread_mutex_lock(&lookup_queue_mutex);
+	while (pending > 0){
+		if (!range_queue.empty()){
+			LookupRange *range = range_queue.front();
+			range_queue.pop_front();
+			pthread_mutex_unlock(&lookup_queue_mutex);
+			run_range(worker, range);
+			pthread_mutex_lock(&lookup_queue_mutex);
+		} else {
+			pthread_cond_wait(&lookup_range_cond, &lookup_queue_mutex);
+		}
+	}
+	pthread_mutex_unlock(&lookup_queue_mutex);
+
+	for (LookupRange &range : ranges)
+		query.truncated = query.truncated || range.truncated;
+	if (topk){
+		merge_topk(ranges, topk, query.results);
+		return;
+	}
+	for (LookupRange &range : ranges){
+		if (range.stop == best && best != SIZE_MAX){
+			query.results = move(range.results);
+			break;
+		}
+	}
+}
+
+void run_lookup_job(LookupJob *job, LookupWorker *worker, LookupState *state){
+	int slot = (worker) ? worker->slot : -1;
+	if (job->session != NULL){
+		LookupQuery &query = job->queries[0];
+		run_stream_push(job->index, job->session, query.frames, query.toggles, slot, query.results);
+		flush_stop_probes(job->index, &job->session->state);
+		return;
+	}
+	lookup_begin(state, job->queries.size() > 1, job->topk, job->radius, job->max_ber);
+	for (LookupQuery &query : job->queries){
+		chrono::time_point<chrono::high_resolution_clock> deadline = chrono::time_point<chrono::high_resolution_clock>::max();
+		if (job->budget_usec > 0)
+			deadline = chrono::high_resolution_clock::now() + chrono::microseconds(job->budget_usec);
+		budget_begin(state, job->max_probes, deadline);
+		query.truncated = false;
+		if (job->scorer == LOOKUP_SCORER_OFFSET){
+			run_offset_lookup(job->index, query.frames, query.toggles, job->threshold, slot, state, query.results);
+		} else if (worker && !job->batch && split_frames > 0 && n_lookup_workers > 1
+			&& query.frames.size() >= 2*(size_t)split_frames){
+			run_split_lookup(worker, job, query, deadline);
+			continue;
+		} else {
+			run_lookup(job->index, query.frames, query.toggles, 0, query.frames.size(),
+					   job->threshold, slot, state, query.results, NULL);
+		}
+		query.truncated = state->truncated;
+	}
+	flush_stop_probes(job->index, state);
+}
+
+static void* lookup_worker(void *arg){
+	LookupWorker worker = {};
+	worker.slot = (int)(intptr_t)arg;
+	while (true){
+		pthread_mutex_lock(&lookup_queue_mutex);
+		while (lookup_queue.empty() && range_queue.empty() && add_queue.empty())
+			pthread_cond_wait(&lookup_queue_cond, &lookup_queue_mutex);
+		if (!range_queue.empty()){
+			LookupRange *range = range_queue.front();
+			range_queue.pop_front();
+			pthread_mutex_unlock(&lookup_queue_mutex);
+			run_range(&worker, range);
+			continue;
+		}
+		if (lookup_queue.empty()){
+			// take the adds queued behind this one to the same index
+			// along, so a stream of long adds builds a segment a batch
+			// rather than one each
+			vector<AddJob*> adds(1, add_queue.front());
+			add_queue.pop_front();
+			uint64_t n_entries = add_job_entries(adds[0]);
+			while (adds[0]->source == NULL && !add_queue.empty() && add_queue.front()->index == adds[0]->index
+				   && add_queue.front()->source == NULL
+				   && n_entries + add_job_entries(add_queue.front()) <= IMPORT_SEGMENT_POSTINGS){
+				n_entries += add_job_entries(add_queue.front());
+				adds.push_back(add_queue.front());
+				add_queue.pop_front();
+			}
+			pthread_mutex_unlock(&lookup_queue_mutex);
+			run_add_batch(adds);
+			for (AddJob *add : adds)
+				RedisModule_UnblockClient(add->bc, add);
+			continue;
+		}
+		LookupJob *job = lookup_queue.front();
+		lookup_queue.pop_front();
+		pthread_mutex_unlock(&lookup_queue_mutex);
+
+		run_lookup_job(job, &worker, &worker.state);
+		RedisModule_UnblockClient(job->bc, job);
+	}
+	return NULL;
+}
+
+/* returns the number of workers actually started */
+int start_lookup_workers(int n){
+	for (int i=0;i < n;i++){
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, lookup_worker, (void*)(intptr_t)n_lookup_workers) != 0)
+			break;
+		pthread_detach(thread);
+		n_lookup_workers++;
+	}
+	return n_lookup_workers;
+}
+
+/*------------------- Result cache ----------------------------------*/
+
+/* With the CACHE module option, each index keeps the results of its */
+/* most recent lookups, keyed on a digest of everything that shapes  */
+/* them.  Any add or delete bumps the index's generation, which       */
+/* empties the cache on its next use.  Only the main thread uses it.  */
+
+typedef struct cache_entry_t {
+	uint64_t digest;
+	vector<uint32_t> frames, toggles;   // the lookup, to tell digest
+	double threshold, max_ber;          // collisions from hits
+	uint32_t topk;
+	int scorer, radius;
+	uint64_t max_probes;
+	vector<FoundId> results;
+	bool truncated;
+} CacheEntry;
+
+typedef struct result_cache_t {
+	list<CacheEntry> entries;   // most recently used first
+	unordered_map<uint64_t, list<CacheEntry>::iterator> map;
+	uint64_t generation;        // index generation the entries are for
+	long long hits, misses;
+} ResultCache;
+
+static long long cache_capacity = 0;     // lookups cached per index, 0 none
+
+static inline uint64_t digest_mix(uint64_t h, uint64_t value){
+	h = (h ^ value)*0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 32);
+}
+
+/* digest of a single query lookup and its options */
+uint64_t lookup_digest(const LookupJob *job){
+	const LookupQuery &query = job->queries[0];
+	uint64_t threshold;
+	memcpy(&threshold, &job->threshold, sizeof(threshold));
+	uint64_t h = digest_mix(0, query.frames.size());
+	for (size_t i=0;i < query.frames.size();i++)
+		h = digest_mix(h, ((uint64_t)query.frames[i] << 32) | query.toggles[i]);
+	h = digest_mix(h, threshold);
+	h = digest_mix(h, job->topk);
+	h = digest_mix(h, ((uint64_t)job->scorer << 32) | (uint32_t)job->radius);
+	uint64_t max_ber;
+	memcpy(&max_ber, &job->max_ber, sizeof(max_ber));
+	h = digest_mix(h, max_ber);
+	return digest_mix(h, job->max_probes);
+}
+
+/* true if the entry holds the results of the job's lookup, not */
+/* just of one with the same digest                             */
+static bool cache_entry_matches(const CacheEntry &entry, const LookupJob *job){
+	const LookupQuery &query = job->queries[0];
+	return entry.threshold == job->threshold && entry.topk == job->topk
+		&& entry.scorer == job->scorer && entry.radius == job->radius
+		&& entry.max_ber == job->max_ber && entry.max_probes == job->max_probes
+		&& entry.frames == query.frames && entry.toggles == query.toggles;
+}
+
+/* look for the job's results in the cache, returns true on a hit. */
+/* On a miss, marks a cacheable job to have its results stored and */
+/* counted as a miss once dispatch_lookup accepts it.  Lookups     */
+/* with a time budget are never cached.                            */
+bool cache_find(ASIndex *index, LookupJob *job){
+	if (cache_capacity == 0 || job->batch || job->session || job->budget_usec > 0) return false;
+	if (index->cache == NULL){
+		index->cache = new ResultCache;
+		index->cache->generation = index->generation;
+		index->cache->hits = index->cache->misses = 0;
+	}
+	ResultCache *cache = index->cache;
+	if (cache->generation != index->generation){
+		cache->entries.clear();
+		cache->map.clear();
+		cache->generation = index->generation;
+	}
+
+	job->digest = lookup_digest(job);
+	auto iter = cache->map.find(job->digest);
+	if (iter == cache->map.end() || !cache_entry_matches(*iter->second, job)){
+		job->cache = true;
+		job->generation = index->generation;
+		return false;
+	}
+	cache->hits++;
+	cache->entries.splice(cache->entries.begin(), cache->entries, iter->second);
+	job->queries[0].results = iter->second->results;
+	job->queries[0].truncated = iter->second->truncated;
+	return true;
+}
+
+/* store the results of a finished job marked by cache_find, unless */
+/* the index changed while it ran or another lookup with the same   */
+/* digest holds the slot                                            */
+void cache_store(LookupJob *job){
+	ASIndex *index = job->index;
+	if (!job->cache || index->dropped || index->cache == NULL || job->generation != index->generation) return;
+	ResultCache *cache = index->cache;
+	if (cache->generation != index->generation || cache->map.count(job->digest)) return;
+
+	const LookupQuery &query = job->queries[0];
+	cache->entries.push_front({job->digest, query.frames, query.toggles, job->threshold, job->max_ber,
+							   job->topk, job->scorer, job->radius, job->max_probes,
+							   query.results, query.truncated});
+	cache->map[job->digest] = cache->entries.begin();
+	if ((long long)cache->entries.size() > cache_capacity){
+		cache->map.erase(cache->entries.back().digest);
+		cache->entries.pop_back();
+	}
+}
+
+size_t cache_mem(const ResultCache *cache){
+	size_t size = sizeof(ResultCache);
+	for (const CacheEntry &entry : cache->entries)
+		size += sizeof(CacheEntry) + 2*sizeof(void*) + entry.results.size()*sizeof(FoundId)
+			+ (entry.frames.size() + entry.toggles.size())*sizeof(uint32_t);
+	return size + cache->map.size()*(sizeof(uint64_t) + 2*sizeof(void*));
+}
+
+/* retrieve a descr field stored in keystr+id hash redis datatype */
+RedisModuleString* GetDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
+	string idstr = RedisModule_StringPtrLen(keystr, NULL);
+	idstr += ":" + to_string(id);
+
+	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_READ);
+	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
+		RedisModule_CloseKey(key);
+		return NULL;
+	}
+
+	RedisModuleString *descr = NULL;
+	RedisModule_HashGet(key, REDISMODULE_HASH_CFIELDS, descr_field, &descr, NULL);
+	RedisModule_CloseKey(key);
+	return descr;
+}
+
+/* set a descr field for a keystr+id redis hash data type */ 
+void SetDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id, RedisModuleString *descr){
+	string idstr = RedisModule_StringPtrLen(keystr, NULL);
+	idstr += ":" + to_string(id);
+
+	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
+	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY){
+		RedisModule_CloseKey(key);
+		return;
+	}
+
+	RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS, descr_field, descr, NULL);
+	RedisModule_CloseKey(key);
+}
+
+void DeleteDescriptionField(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
+	string idstr = RedisModule_StringPtrLen(keystr, NULL);
+	idstr += ":" + to_string(id);
+
+	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
+	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
+		RedisModule_CloseKey(key);
+		return;
+	}
+
+	RedisModule_HashSet(key, REDISMODULE_HASH_CFIELDS, descr_field, REDISMODULE_HASH_DELETE, NULL);
+	RedisModule_CloseKey(key);
+}
+
+void DeleteDescriptionKey(RedisModuleCtx *ctx, RedisModuleString *keystr, long long id){
+	string idstr = RedisModule_StringPtrLen(keystr, NULL);
+	idstr += ":" + to_string(id);
+
+	RedisModuleString *keyidstr = RedisModule_CreateString(ctx, idstr.c_str(), idstr.length());
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keyidstr, REDISMODULE_WRITE);
+	if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_HASH){
+		RedisModule_CloseKey(key);
+		return;
+	}
+
+	RedisModule_DeleteKey(key);
+	RedisModule_CloseKey(key);
+}
+
+/* ids were once drawn from a <key>:counter string key */
+void DeleteCounterKey(RedisModuleCtx *ctx, RedisModuleString *keystr){
+	string counterstr = RedisModule_StringPtrLen(keystr, NULL);
+	counterstr += ":counter";
+
+	RedisModuleString *keycounterstr = RedisModule_CreateString(ctx, counterstr.c_str(), counterstr.length());
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keycounterstr, REDISMODULE_WRITE);
+	RedisModule_DeleteKey(key);
+	RedisModule_CloseKey(key);
+	return;
+}
+
+void DeleteKey(RedisModuleCtx *ctx, RedisModuleString *keystr){
+	RedisModuleKey *key = (RedisModuleKey*)RedisModule_OpenKey(ctx, keystr, REDISMODULE_WRITE);
+	RedisModule_DeleteKey(key);
+	RedisModule_CloseKey(key);
+	return;
+}
+
+/* ------------------ Auscout type methods --------------------------*/
+
+extern "C" void ASIndexTypeFree(void *value);
+
+/* index the tracks from first_ord on in a new read segment */
+static void load_segment(ASIndex *index, uint32_t first_ord){
+	uint32_t n_tracks = index->n_tracks - first_ord;
+	if (n_tracks == 0) return;
+	vector<uint32_t*> frames(n_tracks);
+	vector<uint32_t> n_entries(n_tracks), ords(n_tracks);
+	for (uint32_t i=0;i < n_tracks;i++){
+		frames[i] = index->tracks[first_ord + i].frames;
+		n_entries[i] = index->tracks[first_ord + i].n_entries;
+		ords[i] = first_ord + i;
+	}
+	Segment *seg = build_tracks_segment(ords.data(), frames.data(), n_entries.data(), n_tracks,
+										index->flags & AS_INDEX_COMPRESSED);
+	index->segments = (Segment**)RedisModule_Realloc(index->segments, (index->n_segments + 2)*sizeof(Segment*));
+	index->segments[index->n_segments++] = seg;
+}
+
+/* loaded tracks go straight into read segments of about            */
+/* IMPORT_SEGMENT_POSTINGS postings each, rather than the delta,     */
+/* which is meant for a merge's worth of adds                        */
+extern "C" void* ASIndexTypeRdbLoad(RedisModuleIO *rdb, int encver){
+	if (encver > AUSCOUT_ENCODING_VERSION){
+		RedisModule_LogIOError(rdb, "warning", "rdbload: unable to encode for encver %d", encver);
+		return NULL;
+	}
+
+	// encver 0 predates index flags
+	uint32_t flags = (encver >= 1) ? (uint32_t)RedisModule_LoadUnsigned(rdb) : 0;
+	ASIndex *index = new_index(flags);
+
+	// before encver 2 the next id follows the largest loaded
+	if (encver >= 2) index->next_id = RedisModule_LoadSigned(rdb);
+
+	uint64_t n_ids = RedisModule_LoadUnsigned(rdb);
+	uint32_t first_ord = index->n_tracks;
+	uint64_t n_postings = 0;
+	for (uint64_t i=0;i < n_ids;i++){
+
+		int64_t id = RedisModule_LoadSigned(rdb);
+		uint32_t n_frames = (int32_t)RedisModule_LoadUnsigned(rdb);
+
+		Track *track = new_track(index, id, n_frames);
+		if (track == NULL){
+			RedisModule_LogIOError(rdb, "warning", "rdbload: duplicate id %lld", (long long)id);
+			ASIndexTypeFree(index);
+			return NULL;
+		}
+		index->n_entries += n_frames;
+
+		uint32_t *hashes = TRACK_HASHES(track);
+		uint32_t *positions = TRACK_POS(track);
+		for (uint32_t j=0;j<n_frames;j++){
+			hashes[j] = (uint32_t)RedisModule_LoadUnsigned(rdb);
+			positions[j] = (uint32_t)RedisModule_LoadSigned(rdb);
+			if (index->mih_values != NULL) mih_add_value(index, hashes[j]);
+		}
+		n_postings += n_frames;
+		if (n_postings >= IMPORT_SEGMENT_POSTINGS){
+			load_segment(index, first_ord);
+			first_ord = index->n_tracks;
+			n_postings = 0;
+		}
+	}
+	load_segment(index, first_ord);
+	publish_view(index);
+
+	return index;
+}
+
+extern "C" void ASIndexTypeRdbSave(RedisModuleIO *rdb, void *value){
+	ASIndex *index = (ASIndex*)value;
+	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
+	unsigned char *dict_key = NULL;
+	size_t keylen;
+	void *val = NULL;
+
+	RedisModule_SaveUnsigned(rdb, index->flags);
+	RedisModule_SaveSigned(rdb, index->next_id);
+
+	uint64_t n_ids = RedisModule_DictSize(index->id_dict);
+	RedisModule_SaveUnsigned(rdb, n_ids);
+	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, &val)) != NULL){
+		Track *track = &index->tracks[(uint32_t)(uintptr_t)val];
+		uint64_t nframes = track->n_entries;
+		RedisModule_SaveSigned(rdb, track->id);
+		RedisModule_SaveUnsigned(rdb, nframes);
+		for (uint32_t i=0;i < nframes;i++){
+			uint64_t tmphash = (uint64_t)TRACK_HASHES(track)[i];
+			int64_t pos = (int64_t)TRACK_POS(track)[i];
+			RedisModule_SaveUnsigned(rdb, tmphash);
+			RedisModule_SaveSigned(rdb, pos);
+		}
+	}
+	RedisModule_DictIteratorStop(iter);
+}
+
+extern "C" void ASIndexTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value){
+	ASIndex *index = (ASIndex*)value;
+	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
+	unsigned char *dict_key = NULL;
+	size_t keylen;
+	void *val = NULL;
+
+	long long mih_tables = AS_INDEX_MIH_TABLES(index->flags);
+	long long next_id = index->next_id;
+	if ((index->flags & AS_INDEX_COMPRESSED) && mih_tables > 0)
+		RedisModule_EmitAOF(aof, "auscout.create", "scclcl", key, "COMPRESSED", "MIH", mih_tables, "ID", next_id);
+	else if (index->flags & AS_INDEX_COMPRESSED)
+		RedisModule_EmitAOF(aof, "auscout.create", "sccl", key, "COMPRESSED", "ID", next_id);
+	else if (mih_tables > 0)
+		RedisModule_EmitAOF(aof, "auscout.create", "sclcl", key, "MIH", mih_tables, "ID", next_id);
+	else
+		RedisModule_EmitAOF(aof, "auscout.create", "scl", key, "ID", next_id);
+
+	vector<uint32_t> hashesforid;
+	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, &val)) != NULL){
+		Track *track = &index->tracks[(uint32_t)(uintptr_t)val];
+		for (uint32_t i=0;i < track->n_entries;i++){
+			hashesforid.push_back(htonl(TRACK_HASHES(track)[i]));
+		}
+		
+		RedisModule_EmitAOF(aof, "auscout.add", "sbl",
+					 key, (unsigned char*)hashesforid.data(), hashesforid.size()*sizeof(uint32_t), track->id);
+		hashesforid.clear();
+	}
+	RedisModule_DictIteratorStop(iter);
+}
+
+void free_index(ASIndex *index){
+	for (uint32_t i=0;i < index->n_tracks;i++){
+		RedisModule_Free(index->tracks[i].frames);
+	}
+
+	uint64_t cursor = 0;
+	FrameSlot *slot = NULL;
+	while ((slot = frame_table_next(index->delta, &cursor)) != NULL){
+		RedisModule_Free(slot->postings);
+	}
+	for (uint32_t j=0;j < AS_INDEX_MIH_TABLES(index->flags);j++){
+		cursor = 0;
+		while ((slot = frame_table_next(index->mih[j], &cursor)) != NULL)
+			RedisModule_Free(slot->postings);
+		frame_table_free(index->mih[j]);
+	}
+	if (index->mih_values) frame_table_free(index->mih_values);
+
+	// a running merge keeps its inputs, the timer frees them when it ends
+	MergeJob *job = index->merge;
+	for (uint32_t i=0;i < index->n_segments;i++){
+		if (job == NULL || i < job->first || i >= job->first + job->n_inputs)
+			segment_free(index->segments[i]);
+	}
+	if (job != NULL){
+		job->index = NULL;
+		orphaned_merges.push_back(job);
+	}
+
+	while (index->sessions != NULL){
+		StreamSession *session = index->sessions;
+		index->sessions = session->next;
+		free_session(session);
+	}
+
+	// no lookup is left to read what the view still reaches
+	for (uint32_t i=0;i < index->n_unlinked;i++)
+		index->unlinked[i].free(index->unlinked[i].ptr);
+
+	frame_table_free(index->delta);
+	delete index->cache;
+	RedisModule_FreeDict(NULL, index->id_dict);
+	RedisModule_Free(index->segments);
+	RedisModule_Free(index->tracks);
+	RedisModule_Free(index->view);
+	RedisModule_Free(index->unlinked);
+	RedisModule_Free(index);
+}
+
+/* an index with lookups in flight is only flagged here, and freed */
+/* once the last of them is done with it                           */
+extern "C" void ASIndexTypeFree(void *value){
+	ASIndex *index = (ASIndex*)value;
+	live_indices.erase(index);
+	if (index->pins > 0){
+		__atomic_store_n(&index->dropped, true, __ATOMIC_RELEASE);
+		return;
+	}
+	free_index(index);
+}
+
+extern "C" size_t ASIndexTypeMemUsage(const void *value){
+	ASIndex *index = (ASIndex*)value;
+	uint64_t n_ids = RedisModule_DictSize(index->id_dict);
+	size_t frames_sz = 2*(index->n_entries)*sizeof(uint32_t);
+	size_t postings_sz = index->postings_bytes + index->frozen_bytes;
+	size_t tracks_sz = (index->tracks_capacity)*sizeof(Track);
+	size_t dict_sz = n_ids*(sizeof(int64_t) + sizeof(void*));
+	size_t table_sz = frame_table_mem(index->delta);
+	if (index->frozen) table_sz += frame_table_mem(index->frozen);
+	for (uint32_t j=0;j < AS_INDEX_MIH_TABLES(index->flags);j++)
+		table_sz += frame_table_mem(index->mih[j]);
+	if (index->mih_values) table_sz += frame_table_mem(index->mih_values) + index->mih_bytes;
+	size_t segments_sz = 0;
+	for (uint32_t i=0;i < index->n_segments;i++)
+		segments_sz += segment_mem(index->segments[i]);
+	size_t sessions_sz = 0;
+	for (StreamSession *session = index->sessions;session != NULL;session = session->next){
+		sessions_sz += sizeof(StreamSession);
+		if (!session->busy) sessions_sz += session->state.arena.total;  // a worker may be growing it
+	}
+	size_t cache_sz = (index->cache) ? cache_mem(index->cache) : 0;
+	return sizeof(ASIndex) + frames_sz + postings_sz + tracks_sz + dict_sz + table_sz + segments_sz + sessions_sz + cache_sz;
+}
+
+extern "C" void ASIndexTypeDigest(RedisModuleDigest *digest, void *value){
+	REDISMODULE_NOT_USED(digest);
+	REDISMODULE_NOT_USED(value);
+}
+/* -----------------DEBUGGING COMMANDS-----------------------------*/
+
+/* list all entries by id, a list of hashvalues for each id */
+/* ARGS: key */
+extern "C" int AuscoutList_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 2) return RedisModule_WrongArity(ctx);
+
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) {
+			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			return REDISMODULE_ERR;
+		}
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
 	}
 
 	RedisModule_Log(ctx, "debug", "ID List in key,  %s", RedisModule_StringPtrLen(argv[1], NULL));
 	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
 	unsigned char *dict_key;
 	size_t keylen;
-	EntryList *list = NULL;
+	void *val = NULL;
 	long long count = 0;
-	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
-		Entry *entry = list->head;
-		long long *idptr = (long long*)dict_key;
-		RedisModule_Log(ctx, "debug", "(%d) keylen = %d, id = %lld no. entries = %lu",
-						++count, keylen, *idptr, list->length);
-		int index = 0;
-		while (entry != NULL){
+	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, &val)) != NULL){
+		uint32_t ord = (uint32_t)(uintptr_t)val;
+		Track *track = &index->tracks[ord];
+		RedisModule_Log(ctx, "debug", "(%d) keylen = %d, id = %lld ord = %u no. entries = %lu",
+						++count, keylen, track->id, ord, track->n_entries);
+		for (uint32_t i=0;i < track->n_entries;i++){
 			RedisModule_Log(ctx, "debug", "    (%d) id = %lld, hashvalue = %lu, pos = %lu",
-							++index, entry->id, entry->hash_value, entry->pos);
-			entry = entry->succ;
+							i+1, track->id, TRACK_HASHES(track)[i], TRACK_POS(track)[i]);
+		}
+	}
+
+	RedisModule_Log(ctx, "debug", "list done");
+	RedisModule_DictIteratorStop(iter);
+
+	RedisModule_ReplyWithLongLong(ctx, count);
+	
+	return REDISMODULE_OK;
+}
+
+static void log_postings(RedisModuleCtx *ctx, ASIndex *index, long long count, uint32_t key, PostingCursor *cursor){
+	RedisModule_Log(ctx, "debug", "(%lld) hash frame = %lu no. entries = %u", count, key, cursor->remaining);
+	uint32_t ord, pos;
+	int i = 0;
+	while (posting_next(cursor, &ord, &pos)){
+		RedisModule_Log(ctx, "debug", "    (%d) id = %lld, hash = %lu, pos = %lu%s",
+						++i, index->tracks[ord].id, key, pos,
+						(index->tracks[ord].flags & TRACK_DELETED) ? " (deleted)" : "");
+	}
+}
+
+/* list all hashvalues */
+/* ARGS: key */
+extern "C" int AuscoutIndex_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 2) return RedisModule_WrongArity(ctx);
+
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) {
+			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			return REDISMODULE_ERR;
+		}
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
+	}
+
+	bool compressed = index->flags & AS_INDEX_COMPRESSED;
+	RedisModule_Log(ctx, "debug", "Hash List in key,  %s", RedisModule_StringPtrLen(argv[1], NULL));
+	long long count = 0;
+	FrameTable *tables[2] = { index->delta, index->frozen };
+	for (FrameTable *table : tables){
+		if (table == NULL) continue;
+		RedisModule_Log(ctx, "debug", "%s delta", (table == index->frozen) ? "frozen" : "mutable");
+		uint64_t cursor = 0;
+		FrameSlot *slot = NULL;
+		while ((slot = frame_table_next(table, &cursor)) != NULL){
+			PostingCursor pc;
+			posting_cursor_init(&pc, slot->postings, compressed);
+			log_postings(ctx, index, ++count, slot->key, &pc);
+		}
+	}
+	for (uint32_t s=index->n_segments;s > 0;s--){
+		Segment *seg = index->segments[s-1];
+		RedisModule_Log(ctx, "debug", "segment %u: %lu keys, %lu postings", s-1, seg->n_keys, seg->n_postings);
+		for (uint64_t k=0;k < seg->n_keys;k++){
+			PostingCursor pc;
+			segment_cursor(seg, k, compressed, &pc);
+			log_postings(ctx, index, ++count, seg->keys[k], &pc);
+		}
+	}
+	RedisModule_Log(ctx, "debug", "list done.");
+
+	RedisModule_ReplyWithLongLong(ctx, count);
+	return REDISMODULE_OK;
+}
+
+/* ------------------------------------------------------------------*/
+/* ARGS: key [COMPRESSED] [MIH m] [ID first] */
+extern "C" int AuscoutCreate_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 2) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	uint32_t flags = 0;
+	long long first = 1;
+	for (int i=2;i < argc;i++){
+		const char *opt = RedisModule_StringPtrLen(argv[i], NULL);
+		long long val;
+		if (!strcasecmp(opt, "COMPRESSED")){
+			flags |= AS_INDEX_COMPRESSED;
+		} else if (!strcasecmp(opt, "MIH")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR
+				|| val < 2 || val > MIH_MAX_TABLES){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse MIH parameter");
+				return REDISMODULE_ERR;
+			}
+			flags = (flags & ~(0x0fU << AS_INDEX_MIH_SHIFT)) | ((uint32_t)val << AS_INDEX_MIH_SHIFT);
+			i++;
+		} else if (!strcasecmp(opt, "ID")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &first) == REDISMODULE_ERR
+				|| first < 1){
+				RedisModule_ReplyWithError(ctx, "ERR - Unable to parse id arg");
+				return REDISMODULE_ERR;
+			}
+			i++;
+		} else {
+			RedisModule_ReplyWithError(ctx, "ERR - unrecognized option");
+			return REDISMODULE_ERR;
+		}
+	}
+
+	try {
+		if (GetIndex(ctx, argv[1]) != NULL){
+			RedisModule_ReplyWithError(ctx, "ERR - key already exists");
+			return REDISMODULE_ERR;
+		}
+		ASIndex *index = CreateIndex(ctx, argv[1], flags);
+		index->next_id = first;
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
+	}
+
+	RedisModule_ReplyWithSimpleString(ctx, "OK");
+	RedisModule_ReplicateVerbatim(ctx);
+	return REDISMODULE_OK;
+}
+
+/* index the n_frames network order hash frames of data as track */
+/* id, returns false if id is already indexed.  The caller         */
+/* publishes the view.                                             */
+bool insert_track(ASIndex *index, int64_t id, const uint32_t *data, uint32_t n_frames){
+	uint32_t n_entries = count_entries(data, n_frames);
+	Track *track = new_track(index, id, n_entries);
+	if (track == NULL) return false;
+	uint32_t ord = track - index->tracks;
+	uint32_t *hashes = TRACK_HASHES(track);
+	uint32_t *positions = TRACK_POS(track);
+	code_frames(data, n_frames, hashes, positions);
+	for (uint32_t i=0;i < n_entries;i++)
+		add_entry(index, hashes[i], ord, positions[i]);
+	index->n_entries += n_entries;
+	return true;
+}
+
+/* make the tracks of a batch's jobs visible along with their       */
+/* segments, when the first of the jobs replies.  A job whose ids     */
+/* were taken meanwhile is left out, its postings are dead ones.      */
+void install_batch(ASIndex *index, AddBatch *batch){
+	if (batch->installed) return;
+	batch->installed = true;
+	index->dead_entries += batch->dead_entries;
+	for (AddJob *job : batch->jobs){
+		if (job == NULL) continue;
+		uint32_t ord;
+		bool taken = false;
+		for (uint32_t i=0;!taken && i < job->n_tracks;i++)
+			taken = get_track_ordinal(index, job->ids[i], &ord);
+		if (taken){
+			index->dead_entries += add_job_entries(job);
+			continue;
+		}
+		for (uint32_t i=0;i < job->n_tracks;i++){
+			ord = job->first_ord + i;
+			RedisModule_DictSetC(index->id_dict, &job->ids[i], sizeof(int64_t), (void*)(uintptr_t)ord);
+			Track *track = &index->tracks[ord];
+			track->id = job->ids[i];
+			track->n_entries = job->n_entries[i];
+			__atomic_store_n(&track->frames, job->frames[i], __ATOMIC_RELEASE);
+			__atomic_store_n(&track->flags, 0, __ATOMIC_RELAXED);
+			job->frames[i] = NULL;
+			index->n_entries += job->n_entries[i];
+		}
+		job->installed = true;
+	}
+
+	uint32_t n_segments = index->n_segments + batch->n_segments;
+	index->segments = (Segment**)RedisModule_Realloc(index->segments, (n_segments + 1)*sizeof(Segment*));
+	memcpy(index->segments + index->n_segments, batch->segments, batch->n_segments*sizeof(Segment*));
+	index->n_segments = n_segments;
+	batch->n_segments = 0;
+	index->last_add = RedisModule_Milliseconds();
+	index->generation++;
+	publish_view(index);
+	if (retired.size() >= RECLAIM_RETIRED_MAX) reclaim_retired();
+}
+
+/* reply for an add indexed on a worker thread */
+extern "C" int AuscoutAdd_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	REDISMODULE_NOT_USED(argc);
+	RedisModule_AutoMemory(ctx);
+	AddJob *job = (AddJob*)RedisModule_GetBlockedClientPrivateData(ctx);
+	if (job->index->dropped){
+		RedisModule_ReplyWithError(ctx, "ERR - key deleted meanwhile");
+		return REDISMODULE_OK;
+	}
+	install_batch(job->index, job->batch);
+	if (!job->installed){
+		RedisModule_ReplyWithError(ctx, "ERR - id already exists");
+		return REDISMODULE_OK;
+	}
+	job->replied = true;
+	long long id = job->ids[0];
+	if (job->descr) SetDescriptionField(ctx, argv[1], id, argv[3]);
+
+	RedisModule_ReplyWithLongLong(ctx, id);
+
+	int rc = (job->descr)
+		? RedisModule_Replicate(ctx, "auscout.addtrack", "sssl", argv[1], argv[2], argv[3], id)
+		: RedisModule_Replicate(ctx, "auscout.add", "ssl", argv[1], argv[2], id);
+	if (rc == REDISMODULE_ERR)
+		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+	return REDISMODULE_OK;
+}
+
+/* give back the ids a job reserved but never installed, and its   */
+/* ordinals too when no view was published since and no segment    */
+/* holds their postings, if nothing was reserved after them         */
+static void release_add_job(ASIndex *index, AddJob *job, bool ords){
+	if (job->n_ids > 0 && index->next_id == job->first_id + job->n_ids)
+		index->next_id = job->first_id;
+	if (ords && index->n_tracks == job->first_ord + job->n_tracks
+		&& (index->view == NULL || index->view->n_tracks <= job->first_ord))
+		index->n_tracks = job->first_ord;
+}
+
+/* called whether or not the client is still there to reply to.  The */
+/* tracks of a job whose client went away are dropped: deleted if     */
+/* another job of the batch installed them, otherwise their           */
+/* reservation is given back.                                         */
+extern "C" void AuscoutAdd_FreeData(RedisModuleCtx *ctx, void *privdata){
+	REDISMODULE_NOT_USED(ctx);
+	AddJob *job = (AddJob*)privdata;
+	ASIndex *index = job->index;
+	AddBatch *batch = job->batch;
+	if (job->installed && !job->replied && !index->dropped){
+		for (uint32_t i=0;i < job->n_tracks;i++)
+			delete_track(index, job->first_ord + i);
+	}
+
+	// the job's postings stay in the batch's segments once they are
+	// installed, or while another job of the batch may install them
+	bool held = false;
+	if (batch != NULL){
+		*find(batch->jobs.begin(), batch->jobs.end(), job) = NULL;
+		if (!batch->installed) batch->dead_entries += add_job_entries(job);
+		held = batch->installed || batch->refs > 1;
+		if (--batch->refs == 0){
+			for (uint32_t i=0;i < batch->n_segments;i++)
+				segment_free(batch->segments[i]);
+			RedisModule_Free(batch->segments);
+			delete batch;
+		}
+	}
+	if (!job->installed && !index->dropped)
+		release_add_job(index, job, !held);
+
+	for (uint32_t i=0;i < job->n_tracks;i++){
+		if (job->frames[i]) RedisModule_Free(job->frames[i]);
+	}
+	if (job->map) munmap(job->map, job->map_len);
+	RedisModule_Free(job->source);
+	RedisModule_Free(job->ids);
+	RedisModule_Free(job->frames);
+	RedisModule_Free(job->n_entries);
+	RedisModule_Free(job);
+	if (--index->pins == 0 && index->dropped)
+		free_index(index);
+}
+
+AddJob* new_add_job(ASIndex *index, uint32_t n_tracks){
+	AddJob *job = (AddJob*)RedisModule_Calloc(1, sizeof(AddJob));
+	job->index = index;
+	job->n_tracks = n_tracks;
+	job->ids = (int64_t*)RedisModule_Calloc(n_tracks, sizeof(int64_t));
+	job->frames = (uint32_t**)RedisModule_Calloc(n_tracks, sizeof(uint32_t*));
+	job->n_entries = (uint32_t*)RedisModule_Calloc(n_tracks, sizeof(uint32_t));
+	return job;
+}
+
+/* true if the tracks of an add may be indexed on a worker */
+bool can_add_async(RedisModuleCtx *ctx, ASIndex *index, uint64_t n_frames){
+	int flags = RedisModule_GetContextFlags(ctx);
+	return async_add_frames > 0 && n_frames >= (uint64_t)async_add_frames && n_lookup_workers > 0
+		&& AS_INDEX_MIH_TABLES(index->flags) == 0
+		&& !(flags & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA));
+}
+
+/* reserve ordinals for a job's tracks and hand the building of their */
+/* postings to the worker pool, blocking the client until they are    */
+/* installed.  The view is published at once, so a tracks array the   */
+/* reservation copied is never read by lookups after a delete.        */
+void dispatch_add(RedisModuleCtx *ctx, AddJob *job, RedisModuleCmdFunc reply){
+	ASIndex *index = job->index;
+	reserve_tracks(index, job->n_tracks);
+	job->first_ord = index->n_tracks;
+	for (uint32_t i=0;i < job->n_tracks;i++)
+		reserve_ordinal(index);
+	publish_view(index);
+
+	index->pins++;
+	job->bc = RedisModule_BlockClient(ctx, reply, NULL, AuscoutAdd_FreeData, 0);
+	pthread_mutex_lock(&lookup_queue_mutex);
+	add_queue.push_back(job);
+	pthread_cond_signal(&lookup_queue_cond);
+	pthread_mutex_unlock(&lookup_queue_mutex);
+}
+
+/* ARGS: key hashstr [id]  */
+/* sets blocked, and returns no id, if a worker indexes the track */
+int64_t auscoutadd_common(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, bool descr, bool *blocked){
+	RedisModuleString *keystr = argv[1];
+	RedisModuleString *hashstr = argv[2];
+
+	long long id = 0;
+	if (argc > 3 && RedisModule_StringToLongLong(argv[3], &id) == REDISMODULE_ERR){
+		RedisModule_ReplyWithError(ctx, "ERR - Unable to parse id arg");
+		throw -1;
+	}
+
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) index = CreateIndex(ctx, argv[1]);
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		throw -1;
+	}
+	if (argc == 3) id = reserve_ids(index, 1);
+
+	size_t len;
+	uint32_t *data = (uint32_t*)RedisModule_StringPtrLen(hashstr, &len);
+    uint32_t n_frames = len / sizeof(uint32_t);
+
+	RedisModule_Log(ctx, "debug", "recieved %d hash frames", n_frames);
+
+	// long tracks without a given id, which replicas and the AOF
+	// always have, are indexed on a worker
+	if (argc == 3 && can_add_async(ctx, index, n_frames)){
+		AddJob *job = new_add_job(index, 1);
+		job->ids[0] = id;
+		job->first_id = id;
+		job->n_ids = 1;
+		job->descr = descr;
+		job->n_entries[0] = count_entries(data, n_frames);
+		if (job->n_entries[0] > 0){
+			job->frames[0] = (uint32_t*)RedisModule_Alloc(2*job->n_entries[0]*sizeof(uint32_t));
+			code_frames(data, n_frames, job->frames[0], job->frames[0] + job->n_entries[0]);
 		}
+		dispatch_add(ctx, job, AuscoutAdd_Reply);
+		*blocked = true;
+		return 0;
 	}
 
-	RedisModule_Log(ctx, "debug", "list done");
-	RedisModule_DictIteratorStop(iter);
+	if (!insert_track(index, id, data, n_frames)){
+		RedisModule_ReplyWithError(ctx, "ERR - id already exists");
+		throw -1;
+	}
+	index->last_add = RedisModule_Milliseconds();
+	index->generation++;
+	publish_view(index);
+	if (retired.size() >= RECLAIM_RETIRED_MAX) reclaim_retired();
 
-	RedisModule_ReplyWithLongLong(ctx, count);
+	return id;
+}
+
+
+/* ARGS: key hashbytestr [id] */
+extern "C" int AuscoutAdd_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 3) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	int64_t id;
+	bool blocked = false;
+	try {
+		id = auscoutadd_common(ctx, argv, argc, false, &blocked);
+	} catch (int &e){
+		return REDISMODULE_ERR;
+	}
+	if (blocked) return REDISMODULE_OK;
+
+	RedisModule_ReplyWithLongLong(ctx, id);
+
+	if (RedisModule_Replicate(ctx, "auscout.add", "ssl", argv[1], argv[2], id) == REDISMODULE_ERR){
+		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+		return REDISMODULE_ERR;
+	}
+	
+	return REDISMODULE_OK;
+}
+
+/* ARGS: key hashbytestr descr [id]  */
+extern "C" int AuscoutAddWithDescr_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 4) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	RedisModuleString *descrstr = argv[3];
+
+	int64_t id;
+	bool blocked = false;
+	try {
+		if (argc == 4){
+			id = auscoutadd_common(ctx, argv, argc-1, true, &blocked);
+		} else {
+			argv[3] = argv[4];
+			id = auscoutadd_common(ctx, argv, argc-1, true, &blocked);
+		}
+	} catch (int &e){
+		return REDISMODULE_ERR;
+	}
+	if (blocked) return REDISMODULE_OK;
+
+
+	SetDescriptionField(ctx, argv[1], id,descrstr);
+
+	RedisModule_ReplyWithLongLong(ctx, id);
+
+	if (RedisModule_Replicate(ctx, "auscout.addtrack", "sssl", argv[1], argv[2], descrstr, id)
+		== REDISMODULE_ERR){
+		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+		return REDISMODULE_ERR;
+	}
+	
+	return REDISMODULE_OK;
+}
+
+/* ARGS: key N hashbytestr1 descr1 ... hashbytestrN descrN [ID first] */
+extern "C" int AuscoutMAdd_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 5) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	long long n;
+	if (RedisModule_StringToLongLong(argv[2], &n) == REDISMODULE_ERR || n < 1 || n > MADD_MAX_TRACKS){
+		RedisModule_ReplyWithError(ctx, "ERR - unable to parse N");
+		return REDISMODULE_ERR;
+	}
+	if (argc != 3 + 2*n && argc != 5 + 2*n) return RedisModule_WrongArity(ctx);
+
+	// ids first to first + n - 1, given when replicated
+	long long first = 0;
+	bool given = argc == 5 + 2*n;
+	if (given && (strcasecmp(RedisModule_StringPtrLen(argv[3 + 2*n], NULL), "ID")
+				  || RedisModule_StringToLongLong(argv[4 + 2*n], &first) == REDISMODULE_ERR)){
+		RedisModule_ReplyWithError(ctx, "ERR - Unable to parse id arg");
+		return REDISMODULE_ERR;
+	}
+
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) index = CreateIndex(ctx, argv[1]);
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
+	}
+
+	// check the ids before reserving them, so a rejected batch
+	// does not use any up
+	if (!given) first = index->next_id;
+	uint64_t n_frames = 0;
+	for (long long k=0;k < n;k++){
+		uint32_t ord;
+		if (get_track_ordinal(index, first + k, &ord)){
+			RedisModule_ReplyWithError(ctx, "ERR - id already exists");
+			return REDISMODULE_ERR;
+		}
+		size_t len;
+		RedisModule_StringPtrLen(argv[3 + 2*k], &len);
+		n_frames += len/sizeof(uint32_t);
+	}
+	if (!given) reserve_ids(index, n);
+
+	// size the tracks and delta once for the whole batch
+	reserve_tracks(index, n);
+	reserve_delta(index, n_frames);
+	for (long long k=0;k < n;k++){
+		size_t len;
+		const uint32_t *data = (const uint32_t*)RedisModule_StringPtrLen(argv[3 + 2*k], &len);
+		if (!insert_track(index, first + k, data, len/sizeof(uint32_t))){
+			// cannot happen with the ids checked above, but if it
+			// does, take back the tracks of the batch already indexed
+			for (long long j=0;j < k;j++){
+				uint32_t ord;
+				if (get_track_ordinal(index, first + j, &ord)) delete_track(index, ord);
+			}
+			publish_view(index);
+			RedisModule_ReplyWithError(ctx, "ERR - id already exists");
+			return REDISMODULE_ERR;
+		}
+	}
+	index->last_add = RedisModule_Milliseconds();
+	index->generation++;
+	publish_view(index);
+	if (retired.size() >= RECLAIM_RETIRED_MAX) reclaim_retired();
+
+	RedisModule_ReplyWithArray(ctx, n);
+	for (long long k=0;k < n;k++){
+		SetDescriptionField(ctx, argv[1], first + k, argv[4 + 2*k]);
+		RedisModule_ReplyWithLongLong(ctx, first + k);
+	}
+
+	if (RedisModule_Replicate(ctx, "auscout.madd", "vcl", argv + 1, (size_t)(2 + 2*n), "ID", first)
+		== REDISMODULE_ERR){
+		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+		return REDISMODULE_ERR;
+	}
+	return REDISMODULE_OK;
+}
+
+/*------------------- Fingerprint files -----------------------------*/
+
+/* auscout.import loads a file of tracks from the directory set by    */
+/* the IMPORTDIR module option, mapped rather than read.  The command  */
+/* replicates as auscout.madd commands carrying the tracks it loaded,  */
+/* so replicas and the AOF never read a file of their own.  All        */
+/* integers are big endian, like the frames of auscout.add:            */
+/*   "ASFP", version (uint32), number of tracks (uint64)               */
+/* then for each track                                                 */
+/*   id (int64, 0 to assign the next), number of frames (uint32),      */
+/*   descr length (uint32), descr zero padded to a multiple of 4       */
+/*   bytes, frames (uint32 each)                                       */
+
+static string import_dir;                // real path, empty for no imports
+
+/* the real path of a file name in the import directory, returns */
+/* an error message, or NULL                                      */
+const char* import_path(const char *name, string &path){
+	if (import_dir.empty()) return "ERR - imports need the IMPORTDIR module option";
+	string full = import_dir + "/" + name;
+	char *real = realpath(full.c_str(), NULL);
+	if (real == NULL) return "ERR - unable to open file";
+	path = real;
+	free(real);
+	if (path.compare(0, import_dir.size() + 1, import_dir + "/") != 0)
+		return "ERR - file not in the import directory";
+	return NULL;
+}
+
+/* map a fingerprint file and list its tracks, returns an error */
+/* message, or NULL once mapped                                 */
+const char* map_fingerprint_file(const char *path, void **map, size_t *map_len, vector<ImportTrack> &tracks){
+	int fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0) return "ERR - unable to open file";
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 16){
+		close(fd);
+		return "ERR - not a fingerprint file";
+	}
+	size_t len = st.st_size;
+	void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return "ERR - unable to map file";
+
+	const uint8_t *base = (const uint8_t*)p;
+	uint32_t version;
+	uint64_t n_tracks;
+	memcpy(&version, base + 4, sizeof(version));
+	memcpy(&n_tracks, base + 8, sizeof(n_tracks));
+	n_tracks = be64toh(n_tracks);
+	if (memcmp(base, ASFP_MAGIC, 4) || ntohl(version) != ASFP_VERSION || n_tracks > (len - 16)/16){
+		munmap(p, len);
+		return "ERR - not a fingerprint file";
+	}
+
+	tracks.resize(n_tracks);
+	size_t off = 16;
+	for (ImportTrack &track : tracks){
+		uint64_t id;
+		uint32_t n_frames, descr_len;
+		if (len - off < 16){
+			off = len + 1;
+			break;
+		}
+		memcpy(&id, base + off, sizeof(id));
+		memcpy(&n_frames, base + off + 8, sizeof(n_frames));
+		memcpy(&descr_len, base + off + 12, sizeof(descr_len));
+		off += 16;
+		track.id = (int64_t)be64toh(id);
+		track.n_frames = ntohl(n_frames);
+		track.descr_len = ntohl(descr_len);
+		uint64_t descr_size = ((uint64_t)track.descr_len + 3) & ~3ULL;
+		if (len - off < descr_size + (uint64_t)track.n_frames*sizeof(uint32_t)){
+			off = len + 1;
+			break;
+		}
+		track.descr = (const char*)base + off;
+		track.data = (const uint32_t*)(base + off + descr_size);
+		off += descr_size + track.n_frames*sizeof(uint32_t);
+	}
+	if (off != len){
+		munmap(p, len);
+		return "ERR - truncated or malformed fingerprint file";
+	}
+	madvise(p, len, MADV_SEQUENTIAL);
+	*map = p;
+	*map_len = len;
+	return NULL;
+}
+
+/* replicate imported tracks as auscout.madd commands, each of a run */
+/* of consecutive ids of at most MADD_MAX_TRACKS tracks and about     */
+/* IMPORT_REPLICATE_FRAMES frames, with the first id of the run        */
+void replicate_imported(RedisModuleCtx *ctx, RedisModuleString *keystr, const ImportTrack *tracks,
+						const int64_t *ids, uint32_t n_tracks){
+	vector<RedisModuleString*> args;
+	uint32_t start = 0;
+	uint64_t n_frames = 0;
+	for (uint32_t i=0;i <= n_tracks;i++){
+		uint32_t n = i - start;
+		if (i == n_tracks || (n > 0 && (ids[i] != ids[i-1] + 1 || n == MADD_MAX_TRACKS
+										|| n_frames + tracks[i].n_frames > IMPORT_REPLICATE_FRAMES))){
+			if (n == 0) break;
+			args.clear();
+			args.push_back(keystr);
+			args.push_back(RedisModule_CreateStringFromLongLong(ctx, n));
+			for (uint32_t k=start;k < i;k++){
+				args.push_back(RedisModule_CreateString(ctx, (const char*)tracks[k].data,
+														tracks[k].n_frames*sizeof(uint32_t)));
+				args.push_back(RedisModule_CreateString(ctx, tracks[k].descr, tracks[k].descr_len));
+			}
+			if (RedisModule_Replicate(ctx, "auscout.madd", "vcl", args.data(), args.size(), "ID",
+									  (long long)ids[start]) == REDISMODULE_ERR)
+				RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+			for (size_t k=1;k < args.size();k++)
+				RedisModule_FreeString(ctx, args[k]);
+			start = i;
+			n_frames = 0;
+		}
+		if (i < n_tracks) n_frames += tracks[i].n_frames;
+	}
+}
+
+/* set the descr fields of imported tracks, as auscout.madd does for */
+/* the commands they replicate as, replicate them and reply with how  */
+/* many tracks there were                                             */
+void reply_imported(RedisModuleCtx *ctx, RedisModuleString **argv, const ImportTrack *tracks,
+					const int64_t *ids, uint32_t n_tracks){
+	for (uint32_t i=0;i < n_tracks;i++){
+		RedisModuleString *descr = RedisModule_CreateString(ctx, tracks[i].descr, tracks[i].descr_len);
+		SetDescriptionField(ctx, argv[1], ids[i], descr);
+		RedisModule_FreeString(ctx, descr);
+	}
+	replicate_imported(ctx, argv[1], tracks, ids, n_tracks);
+	RedisModule_ReplyWithLongLong(ctx, n_tracks);
+}
+
+/* reply for an import indexed on a worker thread */
+extern "C" int AuscoutImport_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	REDISMODULE_NOT_USED(argc);
+	RedisModule_AutoMemory(ctx);
+	AddJob *job = (AddJob*)RedisModule_GetBlockedClientPrivateData(ctx);
+	if (job->index->dropped){
+		RedisModule_ReplyWithError(ctx, "ERR - key deleted meanwhile");
+		return REDISMODULE_OK;
+	}
+	install_batch(job->index, job->batch);
+	if (!job->installed){
+		RedisModule_ReplyWithError(ctx, "ERR - id already exists");
+		return REDISMODULE_OK;
+	}
+	job->replied = true;
+	reply_imported(ctx, argv, job->source, job->ids, job->n_tracks);
+	return REDISMODULE_OK;
+}
+
+/* ARGS: key file */
+extern "C" int AuscoutImport_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc != 3) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	string path;
+	void *map;
+	size_t map_len;
+	vector<ImportTrack> tracks;
+	const char *err = import_path(RedisModule_StringPtrLen(argv[2], NULL), path);
+	if (err == NULL) err = map_fingerprint_file(path.c_str(), &map, &map_len, tracks);
+	if (err != NULL){
+		RedisModule_ReplyWithError(ctx, err);
+		return REDISMODULE_ERR;
+	}
+
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) index = CreateIndex(ctx, argv[1]);
+	} catch (int &e){
+		munmap(map, map_len);
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
+	}
+
+	// tracks without an id follow on after the largest id given
+	uint32_t n_tracks = tracks.size();
+	uint32_t n_assigned = 0;
+	uint64_t n_frames = 0;
+	int64_t first = index->next_id;
+	for (ImportTrack &track : tracks){
+		if (track.id == 0) n_assigned++;
+		else if (track.id >= first && track.id < INT64_MAX) first = track.id + 1;
+		n_frames += track.n_frames;
+	}
+	vector<int64_t> ids(n_tracks);
+	for (uint32_t i=0, k=0;i < n_tracks;i++)
+		ids[i] = (tracks[i].id != 0) ? tracks[i].id : first + k++;
+
+	// check the ids before anything is added
+	vector<int64_t> sorted(ids);
+	sort(sorted.begin(), sorted.end());
+	uint32_t ord;
+	bool taken = adjacent_find(sorted.begin(), sorted.end()) != sorted.end();
+	for (size_t i=0;!taken && i < sorted.size();i++)
+		taken = get_track_ordinal(index, sorted[i], &ord);
+	if (taken || tracks.size() > UINT32_MAX - index->n_tracks){
+		munmap(map, map_len);
+		RedisModule_ReplyWithError(ctx, (taken) ? "ERR - id already exists" : "ERR - too many tracks");
+		return REDISMODULE_ERR;
+	}
+
+	if (can_add_async(ctx, index, n_frames)){
+		index->next_id = first;
+		reserve_ids(index, n_assigned);
+		AddJob *job = new_add_job(index, n_tracks);
+		memcpy(job->ids, ids.data(), n_tracks*sizeof(int64_t));
+		job->first_id = first;
+		job->n_ids = n_assigned;
+		job->source = (ImportTrack*)RedisModule_Alloc(n_tracks*sizeof(ImportTrack));
+		memcpy(job->source, tracks.data(), n_tracks*sizeof(ImportTrack));
+		job->map = map;
+		job->map_len = map_len;
+		dispatch_add(ctx, job, AuscoutImport_Reply);
+		return REDISMODULE_OK;
+	}
+
+	reserve_tracks(index, n_tracks);
+	reserve_delta(index, n_frames);
+	for (uint32_t i=0;i < n_tracks;i++)
+		insert_track(index, ids[i], tracks[i].data, tracks[i].n_frames);
+	index->last_add = RedisModule_Milliseconds();
+	index->generation++;
+	publish_view(index);
+	if (retired.size() >= RECLAIM_RETIRED_MAX) reclaim_retired();
+
+	reply_imported(ctx, argv, tracks.data(), ids.data(), n_tracks);
+	munmap(map, map_len);
+	return REDISMODULE_OK;
+}
+
+/* ARGS: key id_value */
+extern "C" int AuscoutDel_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 3) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
+	long long id;
+	if (RedisModule_StringToLongLong(argv[2], &id) == REDISMODULE_ERR){
+		RedisModule_ReplyWithError(ctx, "unable to parse id arg");
+		return REDISMODULE_ERR;
+	}
+	
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) {
+			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			return REDISMODULE_ERR;
+		}
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
+	}
+
+	RedisModule_Log(ctx, "debug", "delete %lld at key %s", id, RedisModule_StringPtrLen(argv[1], NULL));
+	
+	uint32_t ord;
+	if (!get_track_ordinal(index, id, &ord)){
+		RedisModule_ReplyWithError(ctx, "no such id found");
+		return REDISMODULE_ERR;
+	}
+
+	long long n_dels = index->tracks[ord].n_entries;
+
+	delete_track(index, ord);
+	if (retired.size() >= RECLAIM_RETIRED_MAX) reclaim_retired();
+
+	DeleteDescriptionField(ctx, argv[1], id);
+
+	RedisModule_ReplyWithLongLong(ctx, n_dels);
+	RedisModule_ReplicateVerbatim(ctx);
+	return REDISMODULE_OK;
+}
+
+/* reply with the matches of one query, followed by TRUNCATED if */
+/* its budget cut it short.  descrs holds the descriptions        */
+/* already fetched for the command                                */
+void reply_found(RedisModuleCtx *ctx, RedisModuleString *keystr, const LookupQuery &query,
+				 unordered_map<int64_t, RedisModuleString*> &descrs){
+	long n_results = 0;
+	RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+	for (FoundId fnd : query.results){
+		auto iter = descrs.find(fnd.id);
+		if (iter == descrs.end())
+			iter = descrs.emplace(fnd.id, GetDescriptionField(ctx, keystr, fnd.id)).first;
+		RedisModuleString *descr = iter->second;
+		int n = (descr) ? 4 : 3;
+		RedisModule_ReplyWithArray(ctx, n);
+		if (descr) RedisModule_ReplyWithString(ctx, descr);
+		RedisModule_ReplyWithLongLong(ctx, (long long)fnd.id);
+		RedisModule_ReplyWithLongLong(ctx, (long long)fnd.pos);
+		RedisModule_ReplyWithDouble(ctx, fnd.cs);
+		n_results++;
+	}
+	if (query.truncated){
+		RedisModule_ReplyWithSimpleString(ctx, "TRUNCATED");
+		n_results++;
+	}
+	RedisModule_ReplySetArrayLength(ctx, n_results);
+}
+
+/* reply with the matches of a lookup, or of each mlookup query */
+void reply_lookup_results(RedisModuleCtx *ctx, RedisModuleString *keystr, LookupJob *job){
+	unordered_map<int64_t, RedisModuleString*> descrs;
+	if (job->batch){
+		RedisModule_ReplyWithArray(ctx, job->queries.size());
+		for (LookupQuery &query : job->queries)
+			reply_found(ctx, keystr, query, descrs);
+	} else {
+		RedisModule_Log(ctx, "debug", "done looking up - found %d", job->queries[0].results.size());
+		reply_found(ctx, keystr, job->queries[0], descrs);
+	}
+
+	chrono::time_point<chrono::high_resolution_clock> end = chrono::high_resolution_clock::now();
+	auto elapsed = chrono::duration_cast<chrono::microseconds>(end - job->start).count();
+	unsigned int dur = elapsed;
+	RedisModule_Log(ctx, "debug", "Lookup processed in %u microseconds", dur);
+}
+
+/* reply for a lookup finished on a worker thread */
+extern "C" int AuscoutLookup_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	REDISMODULE_NOT_USED(argc);
+	RedisModule_AutoMemory(ctx);
+	LookupJob *job = (LookupJob*)RedisModule_GetBlockedClientPrivateData(ctx);
+	reply_lookup_results(ctx, argv[1], job);
+	cache_store(job);
+	return REDISMODULE_OK;
+}
+
+/* called whether or not the client is still there to reply to */
+extern "C" void AuscoutLookup_FreeData(RedisModuleCtx *ctx, void *privdata){
+	REDISMODULE_NOT_USED(ctx);
+	LookupJob *job = (LookupJob*)privdata;
+	ASIndex *index = job->index;
+	if (job->session) release_session(job->session);
+	if (--index->pins == 0 && index->dropped)
+		free_index(index);
+	delete job;
+}
+
+/* read a query's frames and toggles from their network order arrays */
+/* replies with an error if they are malformed                       */
+int parse_lookup_query(RedisModuleCtx *ctx, RedisModuleString *hashbytestr, RedisModuleString *togglebytestr,
+					   LookupQuery &query){
+	size_t len, len2;
+	uint32_t *hasharray = (uint32_t*)RedisModule_StringPtrLen(hashbytestr, &len);
+	uint32_t *togglesarray = (uint32_t*)RedisModule_StringPtrLen(togglebytestr, &len2);
+
+	if (len < sizeof(uint32_t) || len2 < sizeof(uint32_t)){ // arrays must be at least one integer
+		RedisModule_ReplyWithError(ctx, "insufficient length arrays");
+		return REDISMODULE_ERR;
+	}
 	
+	if (len != len2){
+		RedisModule_ReplyWithError(ctx, "hash array must be equal to toggle array length");
+		return REDISMODULE_ERR;
+	}
+
+	int  n_frames = len/sizeof(uint32_t);
+	query.frames.resize(n_frames);
+	query.toggles.resize(n_frames);
+	for (int i=0;i < n_frames;i++){
+		query.frames[i] = ntohl(hasharray[i]);
+		query.toggles[i] = ntohl(togglesarray[i]);
+		if (bitcount(query.toggles[i]) > LOOKUP_TOGGLE_BITS_MAX){
+			RedisModule_ReplyWithError(ctx, "ERR - too many set bits in toggle array");
+			return REDISMODULE_ERR;
+		}
+	}
+	return REDISMODULE_OK;
+}
+
+/* read the trailing options of a lookup command into job */
+/* replies with an error if one is malformed               */
+int parse_lookup_options(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, LookupJob *job){
+	job->topk = 0;
+	job->scorer = LOOKUP_SCORER_WINDOW;
+	job->radius = -1;
+	job->max_probes = 0;
+	job->budget_usec = 0;
+	job->max_ber = 0;
+	for (int i=0;i < argc;i+=2){
+		const char *opt = RedisModule_StringPtrLen(argv[i], NULL);
+		long long val;
+		if (!strcasecmp(opt, "SCORER")){
+			const char *name = (i + 1 < argc) ? RedisModule_StringPtrLen(argv[i+1], NULL) : "";
+			if (!strcasecmp(name, "WINDOW")){
+				job->scorer = LOOKUP_SCORER_WINDOW;
+			} else if (!strcasecmp(name, "OFFSET")){
+				job->scorer = LOOKUP_SCORER_OFFSET;
+			} else {
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse SCORER parameter");
+				return REDISMODULE_ERR;
+			}
+		} else if (!strcasecmp(opt, "TOPK")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR
+				|| val < 1 || val > LOOKUP_TOPK_MAX){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse TOPK parameter");
+				return REDISMODULE_ERR;
+			}
+			job->topk = val;
+		} else if (!strcasecmp(opt, "RADIUS")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR
+				|| val < 0 || val > MIH_MAX_RADIUS){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse RADIUS parameter");
+				return REDISMODULE_ERR;
+			}
+			job->radius = val;
+		} else if (!strcasecmp(opt, "MAXPROBES")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR || val < 1){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse MAXPROBES parameter");
+				return REDISMODULE_ERR;
+			}
+			job->max_probes = val;
+		} else if (!strcasecmp(opt, "BUDGET")){
+			if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR || val < 1){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse BUDGET parameter");
+				return REDISMODULE_ERR;
+			}
+			job->budget_usec = val;
+		} else if (!strcasecmp(opt, "VERIFY")){
+			double ber;
+			if (i + 1 == argc || RedisModule_StringToDouble(argv[i+1], &ber) == REDISMODULE_ERR
+				|| !(ber > 0 && ber <= 0.5)){
+				RedisModule_ReplyWithError(ctx, "ERR - unable to parse VERIFY parameter");
+				return REDISMODULE_ERR;
+			}
+			job->max_ber = ber;
+		} else {
+			RedisModule_ReplyWithError(ctx, "ERR - unrecognized lookup option");
+			return REDISMODULE_ERR;
+		}
+	}
+	return REDISMODULE_OK;
+}
+
+/* run the job's queries and reply, or hand the job to the worker */
+/* pool, unless the client cannot be blocked                      */
+int dispatch_lookup(RedisModuleCtx *ctx, RedisModuleString *keystr, ASIndex *index, LookupJob *job){
+	if (job->radius >= 0 && AS_INDEX_MIH_TABLES(index->flags) == 0){
+		RedisModule_ReplyWithError(ctx, "ERR - RADIUS needs an index created with MIH");
+		delete job;
+		return REDISMODULE_ERR;
+	}
+	if (job->cache) index->cache->misses++;
+	job->index = index;
+	int flags = RedisModule_GetContextFlags(ctx);
+	if (n_lookup_workers > 0 && !(flags & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA))){
+		index->pins++;
+		index->visible = true;
+		job->bc = RedisModule_BlockClient(ctx, AuscoutLookup_Reply, NULL, AuscoutLookup_FreeData, 0);
+		pthread_mutex_lock(&lookup_queue_mutex);
+		lookup_queue.push_back(job);
+		pthread_cond_signal(&lookup_queue_cond);
+		pthread_mutex_unlock(&lookup_queue_mutex);
+		return REDISMODULE_OK;
+	}
+
+	run_lookup_job(job, NULL, &inline_lookup_state);
+	reply_lookup_results(ctx, keystr, job);
+	cache_store(job);
+	if (job->session) release_session(job->session);
+	delete job;
 	return REDISMODULE_OK;
 }
 
-/* list all hashvalues */
-/* ARGS: key */
-extern "C" int AuscoutIndex_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 2) return RedisModule_WrongArity(ctx);
+/* ARGS: key hashbytestr togglebytestr [threshold] [options] */
+extern "C" int AuscoutLookup_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 4) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+	
+	RedisModuleString *keystr = argv[1];
+
+	chrono::time_point<chrono::high_resolution_clock> start = chrono::high_resolution_clock::now();
+	
+	double threshold = 0.30;
+	int opts = 4;
+	if (argc > 4 && RedisModule_StringToDouble(argv[4], &threshold) == REDISMODULE_OK)
+		opts = 5;
+
+	LookupQuery query;
+	if (parse_lookup_query(ctx, argv[2], argv[3], query) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	LookupJob *job = new LookupJob;
+	if (parse_lookup_options(ctx, argv + opts, argc - opts, job) == REDISMODULE_ERR){
+		delete job;
+		return REDISMODULE_ERR;
+	}
 
 	ASIndex *index = NULL;
 	try {
-		index = GetIndex(ctx, argv[1]);
+		index = GetIndex(ctx, keystr);
 		if (index == NULL) {
 			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			delete job;
 			return REDISMODULE_ERR;
 		}
 	} catch (int &e){
 		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		delete job;
 		return REDISMODULE_ERR;
 	}
 
-	RedisModule_Log(ctx, "debug", "Hash List in key,  %s", RedisModule_StringPtrLen(argv[1], NULL));
-	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->hash_dict, "^", NULL, 0);
-	unsigned char *dict_key;
-	size_t keylen;
-	EntryList *list = NULL;
-	long long count = 0;
-	while ((dict_key = (unsigned char*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
-		Entry *entry = list->head;
-		uint32_t *hashptr = (uint32_t*)dict_key;
-		RedisModule_Log(ctx, "debug", "(%d) keylen = %d, hash frame = %lu no. entries = %d",
-						++count, keylen, *hashptr, list->length);
-		int index=0;
-		while (entry != NULL){
-			RedisModule_Log(ctx, "debug", "    (%d) id = %lld, hash = %lu, pos = %lu",
-							++index, entry->id, entry->hash_value, entry->pos);
-			entry = entry->next;
-		}
-	}
-	RedisModule_Log(ctx, "debug", "list done.");
-	RedisModule_DictIteratorStop(iter);
+	RedisModule_Log(ctx, "debug", "lookup - recieved %d frames - threshold %f", (int)query.frames.size(), threshold);
 
-	RedisModule_ReplyWithLongLong(ctx, count);
-	return REDISMODULE_OK;
+	job->start = start;
+	job->threshold = threshold;
+	job->batch = false;
+	job->queries.push_back(move(query));
+	if (cache_find(index, job)){
+		reply_lookup_results(ctx, keystr, job);
+		delete job;
+		return REDISMODULE_OK;
+	}
+	return dispatch_lookup(ctx, keystr, index, job);
 }
 
-/* ------------------------------------------------------------------*/
-/* ARGS: key hashstr [id]  */
-int64_t auscoutadd_common(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+/* ARGS: key threshold n hashbytestr1 togglebytestr1 ... hashbytestrN togglebytestrN [options] */
+extern "C" int AuscoutMLookup_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 6) return RedisModule_WrongArity(ctx);
+	RedisModule_AutoMemory(ctx);
+
 	RedisModuleString *keystr = argv[1];
-	RedisModuleString *hashstr = argv[2];
 
-	long long id;
-	if (argc == 3){
-		id = get_next_id(ctx, argv[1]);
-	} else {
-		if (RedisModule_StringToLongLong(argv[3], &id) == REDISMODULE_ERR){
-		    RedisModule_ReplyWithError(ctx, "ERR - Unable to parse id arg");
-			throw -1;
-		}
-	}
+	chrono::time_point<chrono::high_resolution_clock> start = chrono::high_resolution_clock::now();
 
-	ASIndex *index = NULL;
-	try {
-		index = GetIndex(ctx, argv[1]);
-		if (index == NULL) index = CreateIndex(ctx, argv[1]);
-	} catch (int &e){
-		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
-		throw -1;
+	double threshold;
+	if (RedisModule_StringToDouble(argv[2], &threshold) == REDISMODULE_ERR){
+		RedisModule_ReplyWithError(ctx, "ERR - unable to parse threshold parameter");
+		return REDISMODULE_ERR;
 	}
 
-	size_t len;
-	uint32_t *data = (uint32_t*)RedisModule_StringPtrLen(hashstr, &len);
-    uint32_t n_frames = len / sizeof(uint32_t);
-
-	RedisModule_Log(ctx, "debug", "recieved %d hash frames", n_frames);
-
-	EntryList *list = (EntryList*)RedisModule_Calloc(1, sizeof(EntryList));
-	if (RedisModule_DictSetC(index->id_dict, &id, sizeof(id), list) == REDISMODULE_ERR){
-		RedisModule_ReplyWithError(ctx, "ERR - id already exists");
-		throw -1;
+	long long n_queries;
+	if (RedisModule_StringToLongLong(argv[3], &n_queries) == REDISMODULE_ERR
+		|| n_queries < 1 || n_queries > MLOOKUP_MAX_QUERIES){
+		RedisModule_ReplyWithError(ctx, "ERR - unable to parse number of queries");
+		return REDISMODULE_ERR;
 	}
+	if (argc < 4 + 2*n_queries) return RedisModule_WrongArity(ctx);
 
-
-	Entry *curr = NULL;
-	uint32_t prev_frame = 0;
-	for (uint32_t i=0;i < n_frames;i++){
-		uint32_t curr_frame = ntohl(data[i]);
-		if (curr_frame != prev_frame){
-			Entry *e = (Entry*)RedisModule_Calloc(1, sizeof(Entry));
-			if (list->head == NULL){
-				list->head = curr = e;
-			} else {
-				curr->succ = e;
-				curr = curr->succ;
-			}
-			curr->id = id;
-			curr->hash_value = curr_frame;
-			curr->pos = i;
-			index->n_entries++;
-			add_entry(index->hash_dict, curr->hash_value, curr);
-			prev_frame = curr_frame;
-			list->length++;
+	LookupJob *job = new LookupJob;
+	if (parse_lookup_options(ctx, argv + 4 + 2*n_queries, argc - 4 - 2*n_queries, job) == REDISMODULE_ERR){
+		delete job;
+		return REDISMODULE_ERR;
+	}
+	job->queries.resize(n_queries);
+	for (long long i=0;i < n_queries;i++){
+		if (parse_lookup_query(ctx, argv[4+2*i], argv[5+2*i], job->queries[i]) == REDISMODULE_ERR){
+			delete job;
+			return REDISMODULE_ERR;
 		}
 	}
 
-	return id;
-}
-
-
-/* ARGS: key hashbytestr [id] */
-extern "C" int AuscoutAdd_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 3) return RedisModule_WrongArity(ctx);
-	RedisModule_AutoMemory(ctx);
-
-	int64_t id;
+	ASIndex *index = NULL;
 	try {
-		id = auscoutadd_common(ctx, argv, argc);
+		index = GetIndex(ctx, keystr);
+		if (index == NULL) {
+			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			delete job;
+			return REDISMODULE_ERR;
+		}
 	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		delete job;
 		return REDISMODULE_ERR;
 	}
 
-	RedisModule_ReplyWithLongLong(ctx, id);
+	RedisModule_Log(ctx, "debug", "mlookup - recieved %lld queries - threshold %f", n_queries, threshold);
 
-	if (RedisModule_Replicate(ctx, "auscout.add", "ssl", argv[1], argv[2], id) == REDISMODULE_ERR){
-		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
-		return REDISMODULE_ERR;
-	}
-	
-	return REDISMODULE_OK;
+	job->start = start;
+	job->threshold = threshold;
+	job->batch = true;
+	return dispatch_lookup(ctx, keystr, index, job);
 }
 
-/* ARGS: key hashbytestr descr [id]  */
-extern "C" int AuscoutAddWithDescr_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 4) return RedisModule_WrongArity(ctx);
+/* ARGS: key [threshold] [TTL seconds] [RADIUS r] */
+extern "C" int AuscoutStreamOpen_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc < 2) return RedisModule_WrongArity(ctx);
 	RedisModule_AutoMemory(ctx);
 
-	RedisModuleString *descrstr = argv[3];
+	double threshold = 0.30;
+	int opts = 2;
+	if (argc > 2 && RedisModule_StringToDouble(argv[2], &threshold) == REDISMODULE_OK)
+		opts = 3;
+
+	long long ttl = STREAM_TTL_DEFAULT;
+	long long radius = -1;
+	for (int i=opts;i < argc;i+=2){
+		const char *opt = RedisModule_StringPtrLen(argv[i], NULL);
+		long long val;
+		if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR){
+			RedisModule_ReplyWithError(ctx, "ERR - unable to parse stream option");
+			return REDISMODULE_ERR;
+		}
+		if (!strcasecmp(opt, "TTL") && val >= 1 && val <= STREAM_TTL_MAX){
+			ttl = val;
+		} else if (!strcasecmp(opt, "RADIUS") && val >= 0 && val <= MIH_MAX_RADIUS){
+			radius = val;
+		} else {
+			RedisModule_ReplyWithError(ctx, "ERR - unrecognized stream option");
+			return REDISMODULE_ERR;
+		}
+	}
 
-	int64_t id;
+	ASIndex *index = NULL;
 	try {
-		if (argc == 4){
-			id = auscoutadd_common(ctx, argv, argc-1);
-		} else {
-			argv[3] = argv[4];
-			id = auscoutadd_common(ctx, argv, argc-1);
+		index = GetIndex(ctx, argv[1]);
+		if (index == NULL) {
+			RedisModule_ReplyWithError(ctx, "ERR - no such key");
+			return REDISMODULE_ERR;
 		}
 	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
 		return REDISMODULE_ERR;
 	}
-
-
-	SetDescriptionField(ctx, argv[1], id,descrstr);
-
-	RedisModule_ReplyWithLongLong(ctx, id);
-
-	if (RedisModule_Replicate(ctx, "auscout.addtrack", "sssl", argv[1], argv[2], descrstr, id)
-		== REDISMODULE_ERR){
-		RedisModule_Log(ctx, "warning", "WARN - Unable to replicate for id");
+	if (radius >= 0 && AS_INDEX_MIH_TABLES(index->flags) == 0){
+		RedisModule_ReplyWithError(ctx, "ERR - RADIUS needs an index created with MIH");
 		return REDISMODULE_ERR;
 	}
-	
+
+	StreamSession *session = (StreamSession*)RedisModule_Calloc(1, sizeof(StreamSession));
+	session->id = next_session_id++;
+	session->threshold = threshold;
+	session->ttl = 1000*ttl;
+	session->last_used = RedisModule_Milliseconds();
+	session->state.radius = radius;
+	tracker_init(&session->state.tracker, &session->state.arena, TRACKER_MIN_CAPACITY);
+	session->next = index->sessions;
+	index->sessions = session;
+
+	RedisModule_ReplyWithLongLong(ctx, session->id);
 	return REDISMODULE_OK;
 }
 
-/* ARGS: key id_value */
-extern "C" int AuscoutDel_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 3) return RedisModule_WrongArity(ctx);
+/* ARGS: key session hashbytestr togglebytestr */
+extern "C" int AuscoutStreamPush_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc != 5) return RedisModule_WrongArity(ctx);
 	RedisModule_AutoMemory(ctx);
 
+	chrono::time_point<chrono::high_resolution_clock> start = chrono::high_resolution_clock::now();
+
 	long long id;
 	if (RedisModule_StringToLongLong(argv[2], &id) == REDISMODULE_ERR){
-		RedisModule_ReplyWithError(ctx, "unable to parse id arg");
+		RedisModule_ReplyWithError(ctx, "ERR - unable to parse session id");
 		return REDISMODULE_ERR;
 	}
-	
+
+	LookupQuery query;
+	if (parse_lookup_query(ctx, argv[3], argv[4], query) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
 	ASIndex *index = NULL;
 	try {
 		index = GetIndex(ctx, argv[1]);
@@ -674,124 +4697,116 @@ extern "C" int AuscoutDel_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv
 		return REDISMODULE_ERR;
 	}
 
-	RedisModule_Log(ctx, "debug", "delete %lld at key %s", id, RedisModule_StringPtrLen(argv[1], NULL));
-	
-	EntryList *list = NULL;
-	if (RedisModule_DictDelC(index->id_dict, &id, sizeof(id), &list) == REDISMODULE_ERR){
-		RedisModule_ReplyWithError(ctx, "no such id found");
+	StreamSession *session = find_session(index, id);
+	if (session == NULL){
+		RedisModule_ReplyWithError(ctx, "ERR - no such session");
 		return REDISMODULE_ERR;
 	}
-
-	index->n_entries -= list->length;
-	
-	Entry *curr = list->head;
-	while (curr != NULL){
-		Entry *tmp = curr;
-		curr = curr->succ;
-		remove_entry(index->hash_dict, tmp->hash_value, tmp);
-		RedisModule_Free(tmp);
+	if (session->busy){
+		RedisModule_ReplyWithError(ctx, "ERR - session busy with an earlier push");
+		return REDISMODULE_ERR;
 	}
-
-	long long n_dels = list->length;
-	
-	RedisModule_Free(list);
-
-	DeleteDescriptionField(ctx, argv[1], id);
-
-	RedisModule_ReplyWithLongLong(ctx, n_dels);
-	RedisModule_ReplicateVerbatim(ctx);
-	return REDISMODULE_OK;
+	session->busy = true;
+	session->last_used = RedisModule_Milliseconds();
+
+	LookupJob *job = new LookupJob;
+	job->start = start;
+	job->threshold = session->threshold;
+	job->batch = false;
+	job->topk = 0;
+	job->scorer = LOOKUP_SCORER_WINDOW;
+	job->radius = -1;
+	job->max_probes = 0;
+	job->budget_usec = 0;
+	job->session = session;
+	job->queries.push_back(move(query));
+	return dispatch_lookup(ctx, argv[1], index, job);
 }
 
-/* ARGS: key hashbytestr togglebytestr [threshold] */
-extern "C" int AuscoutLookup_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-	if (argc < 4) return RedisModule_WrongArity(ctx);
-	RedisModule_AutoMemory(ctx);
-	
-	RedisModuleString *keystr = argv[1];
-	RedisModuleString *hashbytestr = argv[2];
-	RedisModuleString *togglebytestr = argv[3];
+/* ARGS: key session */
+extern "C" int AuscoutStreamClose_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc != 3) return RedisModule_WrongArity(ctx);
 
-	chrono::time_point<chrono::high_resolution_clock> start = chrono::high_resolution_clock::now();
-	
-	double threshold = 0.30;
-	if (argc > 4){
-		if (RedisModule_StringToDouble(argv[4], &threshold) == REDISMODULE_ERR){
-			RedisModule_ReplyWithError(ctx, "ERR - unable to parse threshold parameter");
-			return REDISMODULE_ERR;
-		}
+	long long id;
+	if (RedisModule_StringToLongLong(argv[2], &id) == REDISMODULE_ERR){
+		RedisModule_ReplyWithError(ctx, "ERR - unable to parse session id");
+		return REDISMODULE_ERR;
 	}
-	
-	size_t len, len2;
-	uint32_t *hasharray = (uint32_t*)RedisModule_StringPtrLen(hashbytestr, &len);
-	uint32_t *togglesarray = (uint32_t*)RedisModule_StringPtrLen(togglebytestr, &len2);
 
-	
-	if (len < sizeof(uint32_t) || len2 < sizeof(uint32_t)){ // arrays must be at least one integer
-		RedisModule_ReplyWithError(ctx, "insufficient length arrays");
+	StreamSession *session = NULL;
+	ASIndex *index = NULL;
+	try {
+		index = GetIndex(ctx, argv[1]);
+		if (index != NULL) session = find_session(index, id);
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
 		return REDISMODULE_ERR;
 	}
-	
-	if (len != len2){
-		RedisModule_ReplyWithError(ctx, "hash array must be equal to toggle array length");
+	if (session == NULL){
+		RedisModule_ReplyWithError(ctx, "ERR - no such session");
 		return REDISMODULE_ERR;
 	}
 
-	ASIndex *index = NULL;
+	unlink_session(index, session);
+	if (session->busy)
+		session->closed = true;
+	else
+		free_session(session);
+	RedisModule_ReplyWithSimpleString(ctx, "OK");
+	return REDISMODULE_OK;
+}
+
+/* ARGS: key */
+extern "C" int AuscoutCacheStats_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc != 2) return RedisModule_WrongArity(ctx);
+
+	ResultCache *cache = NULL;
 	try {
-		index = GetIndex(ctx, keystr);
-		if (index == NULL) {
-			RedisModule_ReplyWithError(ctx, "ERR - no such key");
-			return REDISMODULE_ERR;
-		}
+		ASIndex *index = GetIndex(ctx, argv[1]);
+		if (index != NULL) cache = index->cache;
 	} catch (int &e){
 		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
 		return REDISMODULE_ERR;
 	}
 
-	int  n_frames = len/sizeof(uint32_t);
-	
-	RedisModule_Log(ctx, "debug", "lookup - recieved %d frames - threshold %f", n_frames, threshold);
-	
-	map<int64_t, TrackerId> tracker;
-	vector<FoundId> results;
-	for (int i=0;i < n_frames;i++){
-		uint32_t frame = ntohl(hasharray[i]);
-		uint32_t toggle = ntohl(togglesarray[i]);
-		
-		vector<uint32_t> candidates;
-		get_candidates(frame, toggle, candidates);
-		for (uint32_t key : candidates){
-			lookup_hashframe(ctx, i, threshold, index->hash_dict, key, tracker, results);
-		}
-		candidates.clear();
-
-		if (results.size() > 0)
-			break;
-	}
-	
+	RedisModule_ReplyWithArray(ctx, 8);
+	RedisModule_ReplyWithSimpleString(ctx, "hits");
+	RedisModule_ReplyWithLongLong(ctx, (cache) ? cache->hits : 0);
+	RedisModule_ReplyWithSimpleString(ctx, "misses");
+	RedisModule_ReplyWithLongLong(ctx, (cache) ? cache->misses : 0);
+	RedisModule_ReplyWithSimpleString(ctx, "entries");
+	RedisModule_ReplyWithLongLong(ctx, (cache) ? (long long)cache->entries.size() : 0);
+	RedisModule_ReplyWithSimpleString(ctx, "capacity");
+	RedisModule_ReplyWithLongLong(ctx, cache_capacity);
+	return REDISMODULE_OK;
+}
 
-	RedisModule_Log(ctx, "debug", "done looking up - found %d", results.size());
+/* ARGS: key */
+extern "C" int AuscoutStopStats_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+	if (argc != 2) return RedisModule_WrongArity(ctx);
 
-	long n_results = 0;
-	RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-	for (FoundId fnd : results){
-		RedisModuleString *descr = GetDescriptionField(ctx, keystr, fnd.id);
-		int n = (descr) ? 4 : 3;
-		RedisModule_ReplyWithArray(ctx, n);
-		if (descr) RedisModule_ReplyWithString(ctx, descr);
-		RedisModule_ReplyWithLongLong(ctx, (long long)fnd.id);
-		RedisModule_ReplyWithLongLong(ctx, (long long)fnd.pos);
-		RedisModule_ReplyWithDouble(ctx, fnd.cs);
-		n_results++;
+	long long dropped = 0, skipped = 0;
+	try {
+		ASIndex *index = GetIndex(ctx, argv[1]);
+		if (index != NULL){
+			for (uint32_t i=0;i < index->n_segments;i++)
+				dropped += index->segments[i]->n_stops;
+			skipped = __atomic_load_n(&index->stop_probes, __ATOMIC_RELAXED);
+		}
+	} catch (int &e){
+		RedisModule_ReplyWithError(ctx, "ERR - key exists for different type.  Delete first.");
+		return REDISMODULE_ERR;
 	}
-	RedisModule_ReplySetArrayLength(ctx, n_results);
 
-	chrono::time_point<chrono::high_resolution_clock> end = chrono::high_resolution_clock::now();
-	auto elapsed = chrono::duration_cast<chrono::microseconds>(end - start).count();
-	unsigned int dur = elapsed;
-	RedisModule_Log(ctx, "debug", "Lookup processed in %u microseconds", dur);
-	
+	RedisModule_ReplyWithArray(ctx, 8);
+	RedisModule_ReplyWithSimpleString(ctx, "cutoff");
+	RedisModule_ReplyWithLongLong(ctx, stop_postings);
+	RedisModule_ReplyWithSimpleString(ctx, "drop");
+	RedisModule_ReplyWithLongLong(ctx, stop_drop);
+	RedisModule_ReplyWithSimpleString(ctx, "dropped");
+	RedisModule_ReplyWithLongLong(ctx, dropped);
+	RedisModule_ReplyWithSimpleString(ctx, "skipped");
+	RedisModule_ReplyWithLongLong(ctx, skipped);
 	return REDISMODULE_OK;
 }
 
@@ -852,8 +4867,7 @@ extern "C" int AuscoutDelKey_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **a
 	RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(index->id_dict, "^", NULL, 0);
 	long long *dict_key = NULL;
 	size_t keylen;
-	EntryList *list = NULL;
-	while ((dict_key = (long long*)RedisModule_DictNextC(iter, &keylen, (void**)&list)) != NULL){
+	while ((dict_key = (long long*)RedisModule_DictNextC(iter, &keylen, NULL)) != NULL){
 		DeleteDescriptionKey(ctx, argv[1], *dict_key);
 	}
 
@@ -866,6 +4880,8 @@ extern "C" int AuscoutDelKey_RedisCmd(RedisModuleCtx *ctx, RedisModuleString **a
 	return REDISMODULE_OK;
 }
 
+/* ARGS: [WORKERS n] [SPLIT frames] [CACHE n] [STOPFRAMES n] [STOPDROP 0|1] [ASYNCADD frames] */
+/*       [IMPORTDIR path]                                                                  */
 extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
 
 	if (RedisModule_Init(ctx, "auscout", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR){
@@ -873,7 +4889,47 @@ extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
 		return REDISMODULE_ERR;
 	}
 
+	long long n_workers = LOOKUP_WORKERS_DEFAULT;
+	for (int i=0;i < argc;i+=2){
+		const char *opt = RedisModule_StringPtrLen(argv[i], NULL);
+		if (!strcasecmp(opt, "IMPORTDIR") && i + 1 < argc){
+			const char *dir = RedisModule_StringPtrLen(argv[i+1], NULL);
+			char *real = realpath(dir, NULL);
+			struct stat st;
+			if (real == NULL || stat(real, &st) < 0 || !S_ISDIR(st.st_mode)){
+				RedisModule_Log(ctx, "warning", "no import directory %s", dir);
+				free(real);
+				return REDISMODULE_ERR;
+			}
+			import_dir = real;
+			free(real);
+			continue;
+		}
+		long long val;
+		if (i + 1 == argc || RedisModule_StringToLongLong(argv[i+1], &val) == REDISMODULE_ERR){
+			RedisModule_Log(ctx, "warning", "missing value for module option %s", opt);
+			return REDISMODULE_ERR;
+		}
+		if (!strcasecmp(opt, "WORKERS") && val >= 0 && val <= LOOKUP_WORKERS_MAX){
+			n_workers = val;
+		} else if (!strcasecmp(opt, "SPLIT") && (val == 0 || val >= LOOKUP_BLOCK + LOOKUP_STEPS)){
+			split_frames = val;
+		} else if (!strcasecmp(opt, "CACHE") && val >= 0 && val <= RESULT_CACHE_MAX){
+			cache_capacity = val;
+		} else if (!strcasecmp(opt, "STOPFRAMES") && val >= 0 && val <= STOP_POSTINGS_MAX){
+			stop_postings = val;
+		} else if (!strcasecmp(opt, "STOPDROP") && (val == 0 || val == 1)){
+			stop_drop = val;
+		} else if (!strcasecmp(opt, "ASYNCADD") && val >= 0){
+			async_add_frames = val;
+		} else {
+			RedisModule_Log(ctx, "warning", "unrecognized module option %s", opt);
+			return REDISMODULE_ERR;
+		}
+	}
+
 	RedisModule_Log(ctx, "debug", "init auscout module");
+	select_hamming_distance();
 	
 	RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
 	                             .rdb_load = ASIndexTypeRdbLoad,
@@ -888,7 +4944,13 @@ extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
 		return REDISMODULE_ERR;
 
 	RedisModule_Log(ctx, "debug", "create AsIndexType datatype");
+
+	RedisModule_CreateTimer(ctx, MERGE_TIMER_PERIOD, MaintenanceTimer, NULL);
 	
+	if (RedisModule_CreateCommand(ctx, "auscout.create", AuscoutCreate_RedisCmd,
+								  "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
 	if (RedisModule_CreateCommand(ctx, "auscout.add", AuscoutAdd_RedisCmd,
 								  "write deny-oom", 1, -1, 1) == REDISMODULE_ERR)
 		return REDISMODULE_ERR;
@@ -897,6 +4959,14 @@ extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
 								  "write deny-oom", 1, -1, 1) == REDISMODULE_ERR)
 		return REDISMODULE_ERR;
 	
+	if (RedisModule_CreateCommand(ctx, "auscout.madd", AuscoutMAdd_RedisCmd,
+								  "write deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.import", AuscoutImport_RedisCmd,
+								  "write deny-oom admin", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
 	if (RedisModule_CreateCommand(ctx, "auscout.del", AuscoutDel_RedisCmd,
 								  "write deny-oom", 1, -1, 1) == REDISMODULE_ERR)
 		return REDISMODULE_ERR;
@@ -905,6 +4975,30 @@ extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
 								  "readonly deny-oom", 1, -1, 1) == REDISMODULE_ERR)
 		return REDISMODULE_ERR;
 
+	if (RedisModule_CreateCommand(ctx, "auscout.mlookup", AuscoutMLookup_RedisCmd,
+								  "readonly deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.stream.open", AuscoutStreamOpen_RedisCmd,
+								  "readonly deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.stream.push", AuscoutStreamPush_RedisCmd,
+								  "readonly deny-oom", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.stream.close", AuscoutStreamClose_RedisCmd,
+								  "readonly fast", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.cachestats", AuscoutCacheStats_RedisCmd,
+								  "readonly fast", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
+	if (RedisModule_CreateCommand(ctx, "auscout.stopstats", AuscoutStopStats_RedisCmd,
+								  "readonly fast", 1, 1, 1) == REDISMODULE_ERR)
+		return REDISMODULE_ERR;
+
 	if (RedisModule_CreateCommand(ctx, "auscout.size", AuscoutSize_RedisCmd,
 								  "readonly fast", 1, 1, 1) == REDISMODULE_ERR)
 		return REDISMODULE_ERR;
@@ -925,6 +5019,10 @@ extern "C" int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv,
 
 	if (RedisModule_CreateCommand(ctx, "auscout.index", AuscoutIndex_RedisCmd,
 								  "readonly", 1, -1, 1) == REDISMODULE_ERR);
+
+	if (start_lookup_workers(n_workers) < n_workers)
+		RedisModule_Log(ctx, "warning", "only %d of %lld lookup workers started", n_lookup_workers, n_workers);
+	RedisModule_Log(ctx, "debug", "%d lookup workers", n_lookup_workers);
 	
 	return REDISMODULE_OK;
 }
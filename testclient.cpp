@@ -2,10 +2,12 @@
 #include <cstdio>
 #include <string>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <cassert>
 #include <arpa/inet.h>
+#include <unistd.h>
 #include "hiredis.h"
 
 #define MAX_FRAMES 10000
@@ -39,6 +41,27 @@ int AddSequences(redisContext *c, const string &key, const int n_sequences){
 	return count;
 }
 
+/* add three sequences of n_frames with one auscout.madd */
+int AddSequencesBulk(redisContext *c, const string &key, const int n_frames){
+	static uint32_t bulk[3][MAX_FRAMES];
+	for (int i=0;i < 3;i++){
+		for (int j=0;j < n_frames;j++)
+			bulk[i][j] = htonl(rand());
+	}
+
+	size_t len = n_frames*sizeof(uint32_t);
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.madd %s 3 %b %s %b %s %b %s", key.c_str(),
+												  (void*)bulk[0], len, "Bulk #0", (void*)bulk[1], len, "Bulk #1",
+												  (void*)bulk[2], len, "Bulk #2");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 3);
+	assert(reply->element[1]->integer == reply->element[0]->integer + 1);
+	int count = reply->elements;
+	freeReplyObject(reply);
+	return count;
+}
+
 long long AddUniqueSequence(redisContext *c, const string &key, const int len){
 	string descr = "mysequence";
 	uint32_t n = 0;
@@ -59,6 +82,79 @@ long long AddUniqueSequence(redisContext *c, const string &key, const int len){
 	return id;
 }
 
+/* add a track long enough to be indexed on a module worker, */
+/* then look up a stretch of it                               */
+void AddLongSequence(redisContext *c, const string &key){
+	const int n_frames = 30000;
+	static uint32_t longframes[n_frames];
+	for (int i=0;i < n_frames;i++)
+		longframes[i] = htonl(rand() | 1);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.addtrack %s %b %s", key.c_str(),
+												  (void*)longframes, n_frames*sizeof(uint32_t), "Long sequence");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	long long id = reply->integer;
+	freeReplyObject(reply);
+
+	for (int i=0;i < 1000;i++)
+		toggles[i] = 0;
+	reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f", key.c_str(),
+									  (void*)(longframes + 10000), 1000*sizeof(uint32_t),
+									  (void*)toggles, 1000*sizeof(uint32_t), 0.5);
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 1);
+	assert(reply->element[0]->element[1]->integer == id);
+	freeReplyObject(reply);
+}
+
+/* write a small fingerprint file and load it with auscout.import.  */
+/* The server must be on this host and loaded with IMPORTDIR /tmp,   */
+/* returns false if it has no IMPORTDIR                              */
+bool ImportSequences(redisContext *c, const string &key, const int n_sequences){
+	const char *path = "/tmp/auscout_testclient.asfp";
+	FILE *fp = fopen(path, "wb");
+	assert(fp != NULL);
+
+	uint32_t header[4] = { 0, htonl(1), 0, htonl(n_sequences) };
+	memcpy(header, "ASFP", 4);
+	fwrite(header, sizeof(header), 1, fp);
+
+	const int n_frames = 1000;
+	for (int i=0;i < n_sequences;i++){
+		for (int j=0;j < n_frames;j++)
+			frames[j] = htonl(rand());
+		// id 0, frames, 8 character descr needing no padding
+		uint32_t track[4] = { 0, 0, htonl(n_frames), htonl(8) };
+		char descr[9];
+		snprintf(descr, sizeof(descr), "import%02d", i);
+		fwrite(track, sizeof(track), 1, fp);
+		fwrite(descr, 1, 8, fp);
+		fwrite(frames, sizeof(uint32_t), n_frames, fp);
+	}
+	fclose(fp);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.import %s %s", key.c_str(), "auscout_testclient.asfp");
+	assert(reply != NULL);
+	remove(path);
+	if (reply->type == REDIS_REPLY_ERROR && strstr(reply->str, "IMPORTDIR")){
+		cout << "  skipped, no IMPORTDIR" << endl;
+		freeReplyObject(reply);
+		return false;
+	}
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	assert(reply->integer == n_sequences);
+	freeReplyObject(reply);
+
+	// files outside the import directory are refused
+	reply = (redisReply*)redisCommand(c, "auscout.import %s %s", key.c_str(), "../etc/passwd");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ERROR);
+	freeReplyObject(reply);
+	return true;
+}
+
 void QuerySequence(redisContext *c, const string &key){
 	const double threshold = 0.80;
 	const int n_frames = 500;
@@ -94,6 +190,122 @@ void QuerySequence(redisContext *c, const string &key){
 	return;
 }
 
+void QuerySequenceTopK(redisContext *c, const string &key){
+	const double threshold = 0.10;
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = val;
+		val += 100;
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f TOPK 5", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), threshold);
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements >= 1 && reply->elements <= 5);
+
+	redisReply *subreply = reply->element[0];
+	assert(subreply->elements == 4);
+	assert(string(subreply->element[0]->str) == "mysequence");
+	assert(subreply->element[2]->integer == 22);
+
+	freeReplyObject(reply);
+	return;
+}
+
+void QuerySequenceBudget(redisContext *c, const string &key){
+	const double threshold = 0.80;
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0x03;
+		frames[i] = val;
+		val += 100;
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	// one probe per frame, the frames themselves
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f MAXPROBES %d", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), threshold, n_frames);
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 2);
+	assert(string(reply->element[0]->element[0]->str) == "mysequence");
+	assert(reply->element[0]->element[2]->integer == 22);
+	assert(reply->element[1]->type == REDIS_REPLY_STATUS);
+	assert(string(reply->element[1]->str) == "TRUNCATED");
+
+	freeReplyObject(reply);
+	return;
+}
+
+void QuerySequenceVerify(redisContext *c, const string &key){
+	const double threshold = 0.80;
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = val;
+		val += 100;
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f VERIFY 0.05", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), threshold);
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 1);
+	assert(string(reply->element[0]->element[0]->str) == "mysequence");
+	assert(reply->element[0]->element[2]->integer == 22);
+
+	freeReplyObject(reply);
+	return;
+}
+
+/* a noisy slice from the middle of the unique sequence, scored by offset votes */
+void QuerySequenceOffset(redisContext *c, const string &key){
+	const double threshold = 0.50;
+	const int n_frames = 500, shift = 1000;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = (i%4 == 3) ? rand() : 100*(shift + i + 1);
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f SCORER OFFSET", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), threshold);
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 1);
+	redisReply *subreply = reply->element[0];
+	assert(string(subreply->element[0]->str) == "mysequence");
+	assert(subreply->element[2]->integer == shift);
+	double score = atof(subreply->element[3]->str);
+	assert(score >= threshold && score <= 1.0);
+
+	freeReplyObject(reply);
+	return;
+}
+
 void DeleteSequence(redisContext *c, const string &key, const long long id){
 	redisReply *reply = (redisReply*)redisCommand(c, "auscout.del %s %lld", key.c_str(), id);
 	assert(reply != NULL);
@@ -102,6 +314,279 @@ void DeleteSequence(redisContext *c, const string &key, const long long id){
 	return;
 }
 
+/* delete a track while a long add to its index is pending on a    */
+/* worker, then look it up with VERIFY.  The long add is the 17th  */
+/* track, so reserving its ordinal grows the tracks array.          */
+void DeleteDuringLongAdd(redisContext *c, const string &key){
+	assert(AddSequences(c, key, 15) == 15);
+
+	const int n_frames = 2000;
+	static uint32_t track[n_frames];
+	for (int i=0;i < n_frames;i++)
+		track[i] = htonl(rand() | 1);
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.addtrack %s %b %s", key.c_str(),
+												  (void*)track, n_frames*sizeof(uint32_t), "Deleted sequence");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	long long id = reply->integer;
+	freeReplyObject(reply);
+
+	const int n_long = 30000;
+	static uint32_t longframes[n_long];
+	for (int i=0;i < n_long;i++)
+		longframes[i] = htonl(rand() | 1);
+	redisContext *c2 = redisConnect("localhost", 6379);
+	assert(c2 != NULL && !c2->err);
+	redisAppendCommand(c2, "auscout.addtrack %s %b %s", key.c_str(),
+					   (void*)longframes, n_long*sizeof(uint32_t), "Long sequence");
+	int done = 0;
+	while (!done)
+		assert(redisBufferWrite(c2, &done) == REDIS_OK);
+
+	DeleteSequence(c, key, id);
+
+	for (int i=0;i < 500;i++)
+		toggles[i] = 0;
+	reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f VERIFY 0.05", key.c_str(),
+									  (void*)(track + 500), 500*sizeof(uint32_t),
+									  (void*)toggles, 500*sizeof(uint32_t), 0.5);
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 0);
+	freeReplyObject(reply);
+
+	assert(redisGetReply(c2, (void**)&reply) == REDIS_OK);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	freeReplyObject(reply);
+	redisFree(c2);
+}
+
+void GetCacheStats(redisContext *c, const string &key, long long &hits, long long &misses, long long &capacity){
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.cachestats %s", key.c_str());
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 8);
+	hits = reply->element[1]->integer;
+	misses = reply->element[3]->integer;
+	capacity = reply->element[7]->integer;
+	freeReplyObject(reply);
+}
+
+/* with the CACHE module option, a repeated lookup is a hit and */
+/* one after an add or delete is a miss                          */
+void CheckCache(redisContext *c, const string &key){
+	long long hits, misses, capacity;
+	GetCacheStats(c, key, hits, misses, capacity);
+	cout << "  cache hits = " << hits << " misses = " << misses << endl;
+	if (capacity == 0) return;
+
+	QuerySequence(c, key);
+	GetCacheStats(c, key, hits, misses, capacity);
+	QuerySequence(c, key);
+	long long hits2, misses2;
+	GetCacheStats(c, key, hits2, misses2, capacity);
+	assert(hits2 == hits + 1 && misses2 == misses);
+
+	const int n_frames = 1000;
+	for (int i=0;i < n_frames;i++)
+		frames[i] = htonl(rand());
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.addtrack %s %b %s", key.c_str(),
+												  (void*)frames, n_frames*sizeof(uint32_t), "cache probe");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	long long id = reply->integer;
+	freeReplyObject(reply);
+
+	QuerySequence(c, key);
+	GetCacheStats(c, key, hits, misses, capacity);
+	assert(hits == hits2 && misses == misses2 + 1);
+
+	DeleteSequence(c, key, id);
+	QuerySequence(c, key);
+	GetCacheStats(c, key, hits2, misses2, capacity);
+	assert(hits2 == hits && misses2 == misses + 1);
+}
+
+void GetStopStats(redisContext *c, const string &key, long long &cutoff, long long &drop,
+				  long long &dropped, long long &skipped){
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.stopstats %s", key.c_str());
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 8);
+	cutoff = reply->element[1]->integer;
+	drop = reply->element[3]->integer;
+	dropped = reply->element[5]->integer;
+	skipped = reply->element[7]->integer;
+	cout << "  stop frames dropped = " << dropped << " skipped = " << skipped << endl;
+	freeReplyObject(reply);
+}
+
+/* with the STOPFRAMES module option, a hash value with more postings */
+/* than the cutoff is skipped by lookups, which still find the track  */
+/* of QuerySequence.  With STOPDROP, a merge drops its postings.      */
+void CheckStopFrames(redisContext *c, const string &key){
+	long long cutoff, drop, dropped, skipped;
+	GetStopStats(c, key, cutoff, drop, dropped, skipped);
+	if (cutoff == 0 || 2*(cutoff + 1) > MAX_FRAMES) return;
+
+	// runs of the same frame are one posting, so the stop value
+	// alternates with distinct frames to give it cutoff + 1 postings
+	const uint32_t stop = 0xfffffff1;
+	const int n_stop = 2*(cutoff + 1);
+	for (int i=0;i < n_stop;i++)
+		frames[i] = htonl((i % 2 == 0) ? stop : 0xfffe0000 + i);
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.addtrack %s %b %s", key.c_str(),
+												  (void*)frames, n_stop*sizeof(uint32_t), "stop frames");
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	long long id = reply->integer;
+	freeReplyObject(reply);
+
+	// the query of QuerySequence with its first frame the stop frame
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = (i == 0) ? stop : val;
+		val += 100;
+	}
+	SERIALIZE_TO_NET(frames, n_frames);
+
+	reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), 0.80);
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 1);
+	assert(string(reply->element[0]->element[0]->str) == "mysequence");
+	freeReplyObject(reply);
+
+	long long dropped2, skipped2;
+	GetStopStats(c, key, cutoff, drop, dropped2, skipped2);
+	assert(skipped2 > skipped);
+
+	// the idle delta is merged within a few seconds, leaving the
+	// stop value out of the merged segment
+	if (drop){
+		for (int i=0;i < 50 && dropped2 == dropped;i++){
+			usleep(100000);
+			GetStopStats(c, key, cutoff, drop, dropped2, skipped2);
+		}
+		assert(dropped2 > dropped);
+	}
+
+	DeleteSequence(c, key, id);
+}
+
+void QueryStream(redisContext *c, const string &key){
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.stream.open %s 0.80", key.c_str());
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_INTEGER);
+	long long session = reply->integer;
+	freeReplyObject(reply);
+
+	// the query of QuerySequence, in pushes of 50 frames
+	const int n_frames = 500;
+	const int n_push = 50;
+	uint32_t val = 2300;
+	int n_found = 0;
+	for (int i=0;i < n_frames;i+=n_push){
+		for (int j=0;j < n_push;j++){
+			toggles[j] = 0;
+			frames[j] = val;
+			val += 100;
+		}
+
+		SERIALIZE_TO_NET(frames, n_push);
+		reply = (redisReply*)redisCommand(c, "auscout.stream.push %s %lld %b %b", key.c_str(), session,
+										  (void*)frames, n_push*sizeof(uint32_t),
+										  (void*)toggles, n_push*sizeof(uint32_t));
+		assert(reply != NULL);
+		assert(reply->type == REDIS_REPLY_ARRAY);
+		if (reply->elements > 0 && n_found++ == 0){
+			assert(i == 50);  // the first window of 100 frames completes in the second push
+			assert(string(reply->element[0]->element[0]->str) == "mysequence");
+			assert(reply->element[0]->element[2]->integer == 22);
+		}
+		freeReplyObject(reply);
+	}
+	assert(n_found > 0);
+
+	reply = (redisReply*)redisCommand(c, "auscout.stream.close %s %lld", key.c_str(), session);
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_STATUS);
+	freeReplyObject(reply);
+}
+
+void QuerySequenceRadius(redisContext *c, const string &key){
+	const double threshold = 0.80;
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = val ^ (0x01U << (i % 32));  // one bit error the toggles miss
+		val += 100;
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f RADIUS 2", key.c_str(),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t), threshold);
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 1);
+
+	redisReply *subreply = reply->element[0];
+	assert(subreply->elements == 4);
+	assert(string(subreply->element[0]->str) == "mysequence");
+	assert(subreply->element[2]->integer == 22);
+
+	freeReplyObject(reply);
+	return;
+}
+
+void QuerySequences(redisContext *c, const string &key){
+	const double threshold = 0.80;
+	const int n_frames = 500;
+	uint32_t val = 2300;
+	for (int i=0;i < n_frames;i++){
+		toggles[i] = 0;
+		frames[i] = val;
+		val += 100;
+	}
+
+	SERIALIZE_TO_NET(frames, n_frames);
+	SERIALIZE_TO_NET(toggles, n_frames);
+
+	// the same query twice, along with one that matches nothing
+	uint32_t other = htonl(1);
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.mlookup %s %f 3 %b %b %b %b %b %b", key.c_str(), threshold,
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t),
+									  (void*)&other, sizeof(uint32_t),
+									  (void*)toggles, sizeof(uint32_t),
+									  (void*)frames, n_frames*sizeof(uint32_t),
+									  (void*)toggles, n_frames*sizeof(uint32_t));
+
+	assert(reply != NULL);
+	assert(reply->type == REDIS_REPLY_ARRAY);
+	assert(reply->elements == 3);
+	assert(reply->element[1]->type == REDIS_REPLY_ARRAY);
+	assert(reply->element[1]->elements == 0);
+	for (int i=0;i < 3;i+=2){
+		redisReply *subreply = reply->element[i];
+		assert(subreply->type == REDIS_REPLY_ARRAY);
+		assert(subreply->elements == 1);
+		assert(subreply->element[0]->elements == 4);
+		assert(subreply->element[0]->element[2]->integer == 22);
+	}
+
+	freeReplyObject(reply);
+	return;
+}
 
 long long GetCount(redisContext *c, const string &key){
 	redisReply *reply = (redisReply*)redisCommand(c, "auscout.count %s", key.c_str());
@@ -131,6 +616,65 @@ void DeleteKey(redisContext *c, const string &key){
 }
 
 
+/* add the same sequences to a plain index and a compressed one, delete one, */
+/* and check lookups of each give the same results                          */
+void CompareCompressed(redisContext *c, const string &plainkey, const string &compkey){
+	const double threshold = 0.10;
+	const int n_sequences = 50, n_frames = 2000, n_query = 300;
+	static uint32_t sequences[n_sequences][n_frames];
+
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.create %s COMPRESSED", compkey.c_str());
+	assert(reply != NULL && reply->type == REDIS_REPLY_STATUS);
+	freeReplyObject(reply);
+
+	long long ids[n_sequences];
+	for (int i=0;i < n_sequences;i++){
+		for (int j=0;j < n_frames;j++){
+			// a third of the frames shared between sequences for longer posting lists
+			sequences[i][j] = (j%3 == 0) ? rand()%20000 : rand();
+			frames[j] = htonl(sequences[i][j]);
+		}
+		for (const string &key : {plainkey, compkey}){
+			reply = (redisReply*)redisCommand(c, "auscout.add %s %b", key.c_str(),
+											  (void*)frames, n_frames*sizeof(uint32_t));
+			assert(reply != NULL && reply->type == REDIS_REPLY_INTEGER);
+			ids[i] = reply->integer;
+			freeReplyObject(reply);
+		}
+	}
+	DeleteSequence(c, plainkey, ids[0]);
+	DeleteSequence(c, compkey, ids[0]);
+
+	for (int i=0;i < n_sequences;i+=7){
+		for (int j=0;j < n_query;j++){
+			frames[j] = htonl(sequences[i][500 + j]);
+			toggles[j] = 0;
+		}
+		redisReply *replies[2];
+		int k = 0;
+		for (const string &key : {plainkey, compkey}){
+			replies[k] = (redisReply*)redisCommand(c, "auscout.lookup %s %b %b %f", key.c_str(),
+												   (void*)frames, n_query*sizeof(uint32_t),
+												   (void*)toggles, n_query*sizeof(uint32_t), threshold);
+			assert(replies[k] != NULL && replies[k]->type == REDIS_REPLY_ARRAY);
+			k++;
+		}
+		assert(replies[0]->elements == replies[1]->elements);
+		assert(replies[0]->elements == (size_t)((i == 0) ? 0 : 1));
+		for (size_t m=0;m < replies[0]->elements;m++){
+			redisReply *p = replies[0]->element[m], *q = replies[1]->element[m];
+			assert(p->element[0]->integer == ids[i]);
+			assert(p->element[0]->integer == q->element[0]->integer);
+			assert(p->element[1]->integer == q->element[1]->integer);
+			assert(strcmp(p->element[2]->str, q->element[2]->str) == 0);
+		}
+		freeReplyObject(replies[0]);
+		freeReplyObject(replies[1]);
+	}
+	DeleteKey(c, plainkey);
+	DeleteKey(c, compkey);
+}
+
 int main(int argc, char **argv){
 
 	redisContext *c = redisConnect("localhost", 6379);
@@ -158,6 +702,14 @@ int main(int argc, char **argv){
 	assert(total2 == total + 1);
 
 	QuerySequence(c, key);
+	QuerySequences(c, key);
+	QuerySequenceTopK(c, key);
+	QuerySequenceBudget(c, key);
+	QuerySequenceVerify(c, key);
+	QuerySequenceOffset(c, key);
+	QueryStream(c, key);
+	CheckCache(c, key);
+	CheckStopFrames(c, key);
 
 	cout << "Delete unique sequence" << endl;
 	DeleteSequence(c, key, id);
@@ -169,6 +721,48 @@ int main(int argc, char **argv){
 
 	int cnt = GetCount(c, key);
 	assert(cnt == 0);
+
+	cout << "Bulk add" << endl;
+	string bulkkey = key + ":bulk";
+	long long n_bulk = GetCount(c, bulkkey);
+	assert(AddSequencesBulk(c, bulkkey, 1000) == 3);
+	assert(GetCount(c, bulkkey) == n_bulk + 3);
+	DeleteKey(c, bulkkey);
+
+	cout << "Dense ids" << endl;
+	string idkey = key + ":ids";
+	redisReply *reply = (redisReply*)redisCommand(c, "auscout.create %s ID 100", idkey.c_str());
+	assert(reply != NULL && reply->type == REDIS_REPLY_STATUS);
+	freeReplyObject(reply);
+	assert(AddUniqueSequence(c, idkey, 100) == 100);
+	assert(AddUniqueSequence(c, idkey, 100) == 101);
+
+	cout << "Long track" << endl;
+	AddLongSequence(c, idkey);
+
+	cout << "Delete during long add" << endl;
+	string delkey = key + ":del";
+	DeleteDuringLongAdd(c, delkey);
+	DeleteKey(c, delkey);
+
+	cout << "Import file" << endl;
+	long long n_before = GetCount(c, idkey);
+	if (ImportSequences(c, idkey, 10))
+		assert(GetCount(c, idkey) == n_before + 10);
+	DeleteKey(c, idkey);
+
+	cout << "Radius lookup" << endl;
+	string mihkey = key + ":mih";
+	reply = (redisReply*)redisCommand(c, "auscout.create %s MIH 2", mihkey.c_str());
+	assert(reply != NULL && reply->type == REDIS_REPLY_STATUS);
+	freeReplyObject(reply);
+	assert(AddSequences(c, mihkey, 100) == 100);
+	AddUniqueSequence(c, mihkey, 5000);
+	QuerySequenceRadius(c, mihkey);
+	DeleteKey(c, mihkey);
+
+	cout << "Compressed index" << endl;
+	CompareCompressed(c, key + ":plain", key + ":compressed");
 	
 	cout << "Done." << endl;
 	redisFree(c);